@@ -0,0 +1,90 @@
+// Copyright 2025 SiFive
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Microbenchmark of util::sparse_array's access paths, build with `make sparse_array_bench`.
+// Spike's accesses look like a few slowly moving streams (code, stack, data), so three streams of
+// 8-byte accesses walk through their own pages. The page table walk without the page cache is
+// measured through read_range and write_range, which always walk.
+
+#include "util/sparse_array.h"
+
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using memory = util::sparse_array<uint8_t, 36, 12>;
+
+// addresses of three streams moving 8 bytes per access through 1 MiB each
+static std::vector<uint64_t> make_addresses(size_t n) {
+    const uint64_t bases[] = {0x80000000, 0x80423000, 0x87f45000}; // different page cache slots
+    std::vector<uint64_t> addrs(n);
+    for (size_t i = 0; i < n; i++) {
+        addrs[i] = bases[i % 3] + (i / 3 * 8) % (1 << 20);
+    }
+    return addrs;
+}
+
+// best time per access over repeat runs of f over all addresses
+template <typename F> static double measure(const std::vector<uint64_t>& addrs, unsigned repeat, F f) {
+    double best = 0;
+    for (unsigned r = 0; r < repeat; r++) {
+        const auto start = std::chrono::steady_clock::now();
+        for (uint64_t addr : addrs) {
+            f(addr);
+        }
+        const double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+        best = r == 0 ? ns : std::min(best, ns);
+    }
+    return best / addrs.size();
+}
+
+int main(int argc, char* argv[]) {
+    size_t accesses = 1 << 22;
+    unsigned repeat = 5;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg.find("--accesses=") == 0) {
+            accesses = std::stoull(arg.substr(arg.find("=") + 1));
+        } else if (arg.find("--repeat=") == 0) {
+            repeat = std::max(1, std::stoi(arg.substr(arg.find("=") + 1)));
+        } else {
+            std::cerr << "usage: " << argv[0] << " [--accesses=<n>] [--repeat=<n>]" << std::endl;
+            return 1;
+        }
+    }
+
+    memory mem;
+    memory::accessor acc(mem);
+    const auto addrs = make_addresses(accesses);
+    uint8_t buf[8] = {1, 2, 3, 4, 5, 6, 7, 8};
+    uint64_t sink = 0;
+    // the first pass allocates the pages, the best of the repeats is without page faults
+    auto report = [&](const char* name, auto f) {
+        printf("%-28s %7.2f ns\n", name, measure(addrs, repeat, f));
+    };
+
+    report("write_range (walk)", [&](uint64_t a) { mem.write_range(a, buf, 8); });
+    report("write(addr, data, len)", [&](uint64_t a) { mem.write(a, buf, 8); });
+    report("write<8>", [&](uint64_t a) { mem.write<8>(a, buf); });
+    report("accessor write<8>", [&](uint64_t a) { acc.write<8>(a, buf); });
+    report("read_range (walk)", [&](uint64_t a) { mem.read_range(a, buf, 8); sink += buf[0]; });
+    report("read(addr, data, len)", [&](uint64_t a) { mem.read(a, buf, 8); sink += buf[0]; });
+    report("read<8>", [&](uint64_t a) { mem.read<8>(a, buf); sink += buf[0]; });
+    report("accessor read<8>", [&](uint64_t a) { acc.read<8>(a, buf); sink += buf[0]; });
+    printf("%zu accesses, best of %u, %llu pages resident\n", accesses, repeat,
+           (unsigned long long)(mem.resident_bytes() / mem.page_size));
+    return sink == 0xdeadbeef; // keeps the reads
+}
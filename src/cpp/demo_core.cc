@@ -13,19 +13,43 @@
 // limitations under the License.
 
 #include "demo_core.h"
+#include "memory_simulator.h"
 #include "riscv/mmu.h"
 #include "riscv/processor.h"
 #include "riscv/devices.h"
 #include "riscv/remote_bitbang.h"
 #include "riscv/debug_module.h" 
+#include "riscv/extension.h"
+#include "riscv/memtracer.h"
+#include "riscv/trap.h"
+#include "util/checkpoint.h"
+#include "util/hart_state.h"
+#include "util/pc_profiler.h"
+#include "util/host_prof.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <iterator>
+#include <poll.h>
+#include <sys/wait.h>
+#include <unistd.h>
 
 
 char* demo_core::addr_to_mem(reg_t paddr) {
+  auto lock = serialize();
   auto desc = bus->find_device(paddr >> PGSHIFT << PGSHIFT, PGSIZE);
   if (auto mem = dynamic_cast<abstract_mem_t*>(desc.second))
     if (paddr - desc.first < mem->size())
       return mem->contents(paddr - desc.first);
 
+  // pages nobody on the bus claims belong to the external simulator
+  if (direct_mem && mem_sim && desc.second && desc.second == bus_fallback)
+    return mem_sim->get_ptr(paddr);
+
   return NULL;
 }
 
@@ -66,8 +90,6 @@ demo_core::demo_core(const cfg_t* cfg, const debug_module_config_t& dm_config):
     cfg(cfg),
     debug_module(this, dm_config)
 {
-    abstract_device_t* bus_fallback = nullptr;
-
     if (cfg->external_simulator.has_value()) {
         abstract_sim_if_t* ext_sim = cfg->external_simulator.value();
         bus_fallback = new external_sim_device_t(ext_sim);
@@ -97,24 +119,36 @@ demo_core::demo_core(const cfg_t* cfg, const debug_module_config_t& dm_config):
 }
 
 demo_core::~demo_core() {
+    stop_workers();
 }
 
 bool demo_core::reservable(reg_t paddr) { 
-    return true; 
+    // with direct memory, LR/SC is only allowed on memory Spike can reserve
+    // through a host pointer, not on MMIO pages
+    return !direct_mem || addr_to_mem(paddr) != nullptr;
 }
 
 bool demo_core::mmio_fetch(reg_t paddr, size_t len, uint8_t* bytes) {
+    HOST_PROF_SCOPE("demo_core::mmio_fetch");
     // printf("mmio_fetch address: %lx\n"); 
+    auto lock = serialize();
+    note_mmio(paddr);
     return bus->load(paddr, len, bytes); 
 }
 
 bool demo_core::mmio_load(reg_t paddr, size_t len, uint8_t* bytes) { 
+    HOST_PROF_SCOPE("demo_core::mmio_load");
     // printf("mmio_load address: %lx\n");
+    auto lock = serialize();
+    note_mmio(paddr);
     return bus->load(paddr, len, bytes); 
 }
 
 bool demo_core::mmio_store(reg_t paddr, size_t len, const uint8_t* bytes) { 
+    HOST_PROF_SCOPE("demo_core::mmio_store");
     // printf("mmio_store address: %lx\n");
+    auto lock = serialize();
+    note_mmio(paddr);
     return bus->store(paddr, len, bytes); 
 }
 
@@ -131,12 +165,9 @@ const cfg_t& demo_core::get_cfg() const {
 }
 
 const char* demo_core::get_symbol(uint64_t paddr) {
-    for(const auto& [name, addr] : symbols) {
-        if(addr == paddr) {
-            return name.c_str();
-        }
-    }
-    return nullptr;
+    // Spike asks for every logged pc and prints a symbol starting there
+    auto sym = symbols.at(paddr);
+    return sym ? sym->name : nullptr;
 }
 
 processor_t* demo_core::get_core(size_t i) { 
@@ -146,17 +177,69 @@ processor_t* demo_core::get_core(size_t i) {
 void demo_core::reset() {
     for(auto& proc : procs) {
         proc->reset();
+        // memory may have been replaced underneath cached host pointers
+        proc->get_mmu()->flush_tlb();
     }
 }
 
 void demo_core::step(size_t n) {
-    for(auto& proc : procs) {
-        proc->step(n);
+    // the profiler cuts the quantum where the next hart is due for a sample
+    while (n > 0) {
+        size_t slice = n;
+        if (prof) {
+            for (size_t i = 0; i < procs.size(); i++) {
+                slice = std::min<uint64_t>(slice, prof->until_sample(i));
+            }
+        }
+        step_harts(slice);
+        n -= slice;
+        if (stop_tracer && stop_tracer->stopped()) {
+            break; // hart 0 reached run()'s stop_pc
+        }
+        if (prof) {
+            // stacks are read from physical memory, bypassing devices
+            auto read = [this](uint64_t addr, void* data, size_t len) {
+                if (mem_sim->is_mmio_page(addr)) {
+                    return false;
+                }
+                mem_sim->read(addr, static_cast<uint8_t*>(data), len);
+                return true;
+            };
+            for (size_t i = 0; i < procs.size(); i++) {
+                if (prof->advance(i, slice)) {
+                    prof->sample(i, procs[i], read);
+                }
+            }
+        }
     }
     if (remote_bitbang)
             this->remote_bitbang->tick();
 }
 
+void demo_core::step_harts(size_t n) {
+    if (parallel) {
+        step_parallel(n);
+    } else {
+        for(auto& proc : procs) {
+            HOST_PROF_SCOPE("processor_t::step");
+            proc->step(n);
+            // the next hart may store to the reserved address, as between
+            // harts in Spike's own interleaving
+            if (procs.size() > 1) {
+                proc->get_mmu()->yield_load_reservation();
+            }
+        }
+    }
+}
+
+void demo_core::enable_profiler(uint64_t interval) {
+    if (interval) {
+        prof = std::make_unique<util::pc_profiler>(procs.size(), interval);
+    } else {
+        prof.reset();
+    }
+}
+
 void demo_core::enable_debug(bool enable) {
     debug = enable;
     for (auto& proc : procs) {
@@ -176,3 +259,546 @@ void demo_core::configure_log(bool enable_log, bool enable_commitlog) {
 FILE* demo_core::get_log_file() { 
     return log_file.get(); 
 }
+
+static uint64_t retired(processor_t* proc) {
+    return proc->get_state()->minstret->read();
+}
+
+// stops hart 0 right before it executes a pc without single-stepping: the
+// fetch of that pc raises an access fault, which ends processor_t::step with
+// the instructions before it retired, and restore() takes the fault back.
+// Fetches are matched by physical address, which is the pc for guests without
+// address translation, and only in memory, not in device ROMs
+class demo_core::stop_pc_tracer : public memtracer_t {
+public:
+    explicit stop_pc_tracer(processor_t* proc) : proc(proc) {}
+
+    void arm(reg_t pc) {
+        stop_pc = pc;
+        armed = true;
+        hit = false;
+        // TLB entries and decoded instructions filled before skip the tracer
+        proc->get_mmu()->flush_tlb();
+    }
+    void disarm() {
+        if (armed) {
+            armed = false;
+            proc->get_mmu()->flush_tlb();
+        }
+    }
+    bool stopped() const { return hit; }
+
+    bool interested_in_range(uint64_t begin, uint64_t end, access_type type) override {
+        return armed && type == FETCH && begin <= stop_pc && stop_pc < end;
+    }
+    void trace(uint64_t addr, size_t bytes, access_type type) override {
+        if (!armed || type != FETCH || addr != stop_pc || proc->get_state()->pc != stop_pc) {
+            return;
+        }
+        saved = util::save_hart_state(proc);
+        armed = false;
+        hit = true;
+        throw trap_instruction_access_fault(proc->get_state()->v, addr, 0, 0);
+    }
+    void clean_invalidate(uint64_t addr, size_t bytes, bool clean, bool inval) override {}
+
+    // back to the state before the fault, keeping the counters step() advanced
+    void restore() {
+        auto* s = proc->get_state();
+        const std::pair<reg_t, reg_t> counters[] = {{CSR_MINSTRET, s->csrmap[CSR_MINSTRET]->read()},
+                                                    {CSR_MCYCLE, s->csrmap[CSR_MCYCLE]->read()}};
+        util::restore_hart_state(proc, saved.data(), saved.size());
+        for (auto& counter : counters) {
+            auto& reg = s->csrmap[counter.first];
+            reg->write(counter.second);
+            // Spike compensates counter writes for the increment of the writing instruction
+            if (reg->read() != counter.second) {
+                reg->write(2 * counter.second - reg->read());
+            }
+        }
+        hit = false;
+    }
+
+private:
+    processor_t* const proc;
+    reg_t stop_pc{0};
+    bool armed{false};
+    bool hit{false};
+    std::vector<uint8_t> saved;
+};
+
+demo_core::run_status demo_core::run(const run_limits& limits) {
+    assert(mem_sim != nullptr && "run() needs set_memory()");
+    run_status status;
+    std::vector<uint64_t> start_instret;
+    next_checkpoint = checkpoint_interval;
+    for (auto& proc : procs) {
+        start_instret.push_back(retired(proc));
+        next_checkpoint += start_instret.back();
+    }
+    auto retired_since_start = [&]() {
+        uint64_t total = 0;
+        for (size_t i = 0; i < procs.size(); i++) {
+            total += retired(procs[i]) - start_instret[i];
+        }
+        return total;
+    };
+
+    if (limits.stop_pc) {
+        if (!stop_tracer) {
+            stop_tracer = std::make_unique<stop_pc_tracer>(procs[0]);
+            procs[0]->get_mmu()->register_memtracer(stop_tracer.get());
+        }
+        stop_tracer->arm(limits.stop_pc);
+    }
+
+    const auto start_time = std::chrono::steady_clock::now();
+    auto elapsed = [&]() {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+    };
+
+    while (true) {
+        if (mem_sim->has_exited()) {
+            status.reason = exit_reason::finisher;
+            status.exit_code = mem_sim->exit_status();
+            break;
+        }
+        if (limits.stop_pc && procs[0]->get_state()->pc == limits.stop_pc) {
+            status.reason = exit_reason::stop_pc;
+            break;
+        }
+        const uint64_t done = retired_since_start();
+        if (limits.max_instructions && done >= limits.max_instructions) {
+            status.reason = exit_reason::instruction_limit;
+            break;
+        }
+        if (limits.timeout > 0 && elapsed() >= limits.timeout) {
+            status.reason = exit_reason::timeout;
+            break;
+        }
+        size_t n = quantum_ctl.get();
+        if (limits.max_instructions) {
+            // every hart steps n, the budget is shared by all of them
+            const uint64_t left = limits.max_instructions - done;
+            n = std::min<uint64_t>(n, (left + procs.size() - 1) / procs.size());
+        }
+        step(n);
+        if (stop_tracer && stop_tracer->stopped()) {
+            // hart 0 is back at stop_pc, checked at the top of the loop
+            stop_tracer->restore();
+        }
+
+        if (checkpoint_interval) {
+            uint64_t total = 0;
+            for (auto& proc : procs) {
+                total += retired(proc);
+            }
+            if (total >= next_checkpoint) {
+                save_checkpoint(checkpoint_file + "." + std::to_string(checkpoint_seq), checkpoint_seq > 0);
+                checkpoint_seq++;
+                next_checkpoint = total + checkpoint_interval;
+            }
+        }
+
+        if (quantum_ctl.is_adaptive()) {
+            // a halted hart or a pending interrupt needs a prompt reaction. Remote bitbang's
+            // tick() does not tell whether it served commands, a debugger polling running
+            // harts is answered once per quantum
+            bool urgent = false;
+            for (auto& proc : procs) {
+                auto* state = proc->get_state();
+                urgent |= state->debug_mode || (state->mip->read() & state->mie->read());
+            }
+            if (urgent) {
+                quantum_ctl.request_min();
+            }
+            quantum_ctl.next();
+        }
+    }
+
+    if (stop_tracer) {
+        stop_tracer->disarm();
+    }
+    status.wall_time = elapsed();
+    for (size_t i = 0; i < procs.size(); i++) {
+        status.instret.push_back(retired(procs[i]) - start_instret[i]);
+        status.total_instret += status.instret.back();
+    }
+    if (status.wall_time > 0) {
+        status.mips = status.total_instret / status.wall_time / 1e6;
+    }
+    return status;
+}
+
+void demo_core::save_checkpoint(const std::string& file, bool delta) {
+    assert(mem_sim != nullptr && "checkpoints need set_memory()");
+    util::checkpoint_writer ckpt(file);
+    for (size_t i = 0; i < procs.size(); i++) {
+        ckpt.add("hart" + std::to_string(i), util::save_hart_state(procs[i]));
+    }
+    mem_sim->save_state(ckpt, delta);
+    ckpt.close();
+    // writes through host pointers are invisible to the dirty tracking, make
+    // Spike ask for them again
+    if (direct_mem) {
+        for (auto& proc : procs) {
+            proc->get_mmu()->flush_tlb();
+        }
+    }
+}
+
+void demo_core::set_periodic_checkpoints(const std::string& file, uint64_t interval) {
+    checkpoint_file = file;
+    checkpoint_interval = interval;
+    checkpoint_seq = 0;
+}
+
+void demo_core::restore_checkpoint(const std::string& file) {
+    assert(mem_sim != nullptr && "checkpoints need set_memory()");
+    util::checkpoint_reader ckpt(file);
+    if (ckpt.has("hart" + std::to_string(procs.size()))) {
+        throw std::runtime_error("checkpoint " + file + " was taken with more harts");
+    }
+    // memory first, restoring the harts flushes their TLBs
+    mem_sim->restore_state(ckpt);
+    for (size_t i = 0; i < procs.size(); i++) {
+        auto hart = ckpt.get("hart" + std::to_string(i));
+        util::restore_hart_state(procs[i], hart.first, hart.second);
+    }
+}
+
+// what a forked run writes to its pipe, followed by the instructions retired per hart
+struct forked_status {
+    uint32_t reason;
+    uint32_t exit_code;
+    uint64_t total_instret;
+    double wall_time;
+    double mips;
+};
+
+static bool read_all(int fd, void* buf, size_t len) {
+    uint8_t* p = static_cast<uint8_t*>(buf);
+    while (len > 0) {
+        const ssize_t n = read(fd, p, len);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+std::vector<demo_core::run_status> demo_core::fork_runs(
+        const std::vector<std::vector<memory_patch>>& variants, const run_limits& limits,
+        size_t max_children) {
+    assert(mem_sim != nullptr && "fork_runs() needs set_memory()");
+    if (max_children == 0) {
+        max_children = std::max(1u, std::thread::hardware_concurrency());
+    }
+    std::vector<run_status> results(variants.size());
+    // only the calling thread survives fork(), children start their own workers
+    const bool was_parallel = parallel;
+    stop_workers();
+    // anything still buffered would be printed again by every child
+    std::cout.flush();
+    fflush(nullptr);
+
+    // children by pid: index of their variant and the read end of their pipe.
+    // A status is a few hundred bytes and fits the pipe, a child's pipe becomes
+    // readable once it wrote its status or died. Only these pids are waited
+    // for, other children of the caller are left alone
+    std::map<pid_t, std::pair<size_t, int>> children;
+    auto reap = [&]() {
+        std::vector<pollfd> pfds;
+        for (const auto& child : children) {
+            pfds.push_back({child.second.second, POLLIN, 0});
+        }
+        while (poll(pfds.data(), pfds.size(), -1) < 0) {
+            if (errno != EINTR) {
+                throw std::runtime_error("fork_runs: poll failed");
+            }
+        }
+        size_t ready = 0;
+        while (pfds[ready].revents == 0) {
+            ready++;
+        }
+        auto it = std::next(children.begin(), ready);
+        auto& status = results[it->second.first];
+        forked_status fs;
+        status.instret.resize(procs.size());
+        if (read_all(it->second.second, &fs, sizeof(fs))
+            && read_all(it->second.second, status.instret.data(), procs.size() * sizeof(uint64_t))) {
+            status.reason = static_cast<exit_reason>(fs.reason);
+            status.exit_code = fs.exit_code;
+            status.total_instret = fs.total_instret;
+            status.wall_time = fs.wall_time;
+            status.mips = fs.mips;
+        } else {
+            status = run_status();
+            status.reason = exit_reason::aborted;
+        }
+        close(it->second.second);
+        // ECHILD: the caller ignores SIGCHLD or reaped the child already
+        int wstatus;
+        while (waitpid(it->first, &wstatus, 0) < 0 && errno == EINTR) {
+        }
+        children.erase(it);
+    };
+
+    for (size_t i = 0; i < variants.size(); i++) {
+        while (children.size() >= max_children) {
+            reap();
+        }
+        int fds[2];
+        if (pipe(fds) != 0) {
+            throw std::runtime_error("fork_runs: cannot create pipe");
+        }
+        const pid_t pid = fork();
+        if (pid < 0) {
+            throw std::runtime_error("fork_runs: fork failed");
+        }
+        if (pid == 0) {
+            close(fds[0]);
+            // read ends of the variants forked before, a child must not keep them open
+            for (const auto& child : children) {
+                close(child.second.second);
+            }
+            // the debugger stays attached to the parent
+            remote_bitbang = nullptr;
+            // all children would write the same chain of files
+            checkpoint_interval = 0;
+            set_parallel(was_parallel);
+            for (const auto& patch : variants[i]) {
+                mem_sim->write(patch.addr, patch.bytes.data(), patch.bytes.size());
+            }
+            // patches may hit code Spike has already decoded
+            for (auto& proc : procs) {
+                proc->get_mmu()->flush_icache();
+            }
+            const run_status status = run(limits);
+            const forked_status fs{static_cast<uint32_t>(status.reason), status.exit_code,
+                                   status.total_instret, status.wall_time, status.mips};
+            const ssize_t instret_len = status.instret.size() * sizeof(uint64_t);
+            const bool sent = write(fds[1], &fs, sizeof(fs)) == ssize_t(sizeof(fs))
+                              && write(fds[1], status.instret.data(), instret_len) == instret_len;
+            fflush(nullptr);
+            _exit(sent ? 0 : 1);
+        }
+        close(fds[1]);
+        children[pid] = {i, fds[0]};
+    }
+    while (!children.empty()) {
+        reap();
+    }
+    set_parallel(was_parallel);
+    return results;
+}
+
+void demo_core::note_mmio(reg_t paddr) {
+    if (!quantum_ctl.is_adaptive()) {
+        return;
+    }
+    // plain memory reached through the fallback is not device traffic
+    auto desc = bus->find_device(paddr, 1);
+    if (desc.second != bus_fallback || (mem_sim && mem_sim->is_mmio_page(paddr))) {
+        quantum_ctl.note_activity();
+    }
+}
+
+void demo_core::set_memory(memory_simulator* mem_sim) {
+    this->mem_sim = mem_sim;
+}
+
+void demo_core::set_direct_memory(bool enable) {
+    direct_mem = enable;
+    // drop translations cached with the previous setting
+    for (auto& proc : procs) {
+        proc->get_mmu()->flush_tlb();
+    }
+}
+
+std::unique_lock<std::mutex> demo_core::serialize() {
+    if (parallel) {
+        return std::unique_lock<std::mutex>(sim_lock);
+    }
+    return std::unique_lock<std::mutex>();
+}
+
+// Spike's implementations of the A extension's instructions, exported by libriscv
+#define ATOMIC_INSNS(X) \
+    X(lr_w, LR_W, uint32_t, lr) X(lr_d, LR_D, uint64_t, lr) \
+    X(sc_w, SC_W, uint32_t, sc) X(sc_d, SC_D, uint64_t, sc) \
+    X(amoswap_w, AMOSWAP_W, uint32_t, amo) X(amoswap_d, AMOSWAP_D, uint64_t, amo) \
+    X(amoadd_w, AMOADD_W, uint32_t, amo) X(amoadd_d, AMOADD_D, uint64_t, amo) \
+    X(amoxor_w, AMOXOR_W, uint32_t, amo) X(amoxor_d, AMOXOR_D, uint64_t, amo) \
+    X(amoand_w, AMOAND_W, uint32_t, amo) X(amoand_d, AMOAND_D, uint64_t, amo) \
+    X(amoor_w, AMOOR_W, uint32_t, amo) X(amoor_d, AMOOR_D, uint64_t, amo) \
+    X(amomin_w, AMOMIN_W, uint32_t, amo) X(amomin_d, AMOMIN_D, uint64_t, amo) \
+    X(amomax_w, AMOMAX_W, uint32_t, amo) X(amomax_d, AMOMAX_D, uint64_t, amo) \
+    X(amominu_w, AMOMINU_W, uint32_t, amo) X(amominu_d, AMOMINU_D, uint64_t, amo) \
+    X(amomaxu_w, AMOMAXU_W, uint32_t, amo) X(amomaxu_d, AMOMAXU_D, uint64_t, amo)
+
+#define DECLARE_SPIKE_INSN(name, NAME, type, kind) \
+    extern reg_t fast_rv32i_##name(processor_t*, insn_t, reg_t); \
+    extern reg_t fast_rv64i_##name(processor_t*, insn_t, reg_t); \
+    extern reg_t fast_rv32e_##name(processor_t*, insn_t, reg_t); \
+    extern reg_t fast_rv64e_##name(processor_t*, insn_t, reg_t); \
+    extern reg_t logged_rv32i_##name(processor_t*, insn_t, reg_t); \
+    extern reg_t logged_rv64i_##name(processor_t*, insn_t, reg_t); \
+    extern reg_t logged_rv32e_##name(processor_t*, insn_t, reg_t); \
+    extern reg_t logged_rv64e_##name(processor_t*, insn_t, reg_t);
+ATOMIC_INSNS(DECLARE_SPIKE_INSN)
+#undef DECLARE_SPIKE_INSN
+
+// Registered as a custom extension its instructions take precedence over
+// Spike's, they run Spike's own implementation under atomic_lock. Spike keeps
+// a reservation until the hart itself yields it, so an SC first compares the
+// reserved memory with what the LR read: host pointer stores of other harts
+// never reach the simulator
+class demo_core::serialized_atomics : public extension_t {
+public:
+    enum kind { lr, sc, amo };
+
+    explicit serialized_atomics(demo_core* core) : core(core) {}
+
+    const char* name() const override { return "demo_core_atomics"; }
+
+    std::vector<insn_desc_t> get_instructions(const processor_t&) override {
+        std::vector<insn_desc_t> insns;
+#define SERIALIZED_INSN(name, NAME, type, kind) \
+        insns.push_back({MATCH_##NAME, MASK_##NAME, \
+                         run<fast_rv32i_##name, kind, type>, run<fast_rv64i_##name, kind, type>, \
+                         run<fast_rv32e_##name, kind, type>, run<fast_rv64e_##name, kind, type>, \
+                         run<logged_rv32i_##name, kind, type>, run<logged_rv64i_##name, kind, type>, \
+                         run<logged_rv32e_##name, kind, type>, run<logged_rv64e_##name, kind, type>});
+        ATOMIC_INSNS(SERIALIZED_INSN)
+#undef SERIALIZED_INSN
+        return insns;
+    }
+
+    std::vector<disasm_insn_t*> get_disasms(const processor_t*) override { return {}; }
+
+private:
+    template <insn_func_t F, kind K, typename T>
+    static reg_t run(processor_t* p, insn_t insn, reg_t pc) {
+        auto* self = static_cast<serialized_atomics*>(p->get_extension("demo_core_atomics"));
+        if (!self->core->parallel) {
+            return F(p, insn, pc);
+        }
+        std::lock_guard<std::mutex> guard(self->core->atomic_lock);
+        state_t* s = p->get_state();
+        const reg_t addr = s->XPR[insn.rs1()]; // rd may overwrite rs1
+        if (K == sc && addr == self->reserved_addr && !still_reserved<T>(p, addr, self->reserved_value)) {
+            p->get_mmu()->yield_load_reservation();
+        }
+        const reg_t npc = F(p, insn, pc);
+        if (K == lr) {
+            self->reserved_addr = addr;
+            self->reserved_value = insn.rd() ? T(s->XPR[insn.rd()]) : p->get_mmu()->load<T>(addr);
+        } else if (K == sc) {
+            self->reserved_addr = ~reg_t(0);
+        }
+        return npc;
+    }
+
+    template <typename T> static bool still_reserved(processor_t* p, reg_t addr, uint64_t value) {
+        try {
+            return p->get_mmu()->load<T>(addr) == T(value);
+        } catch (trap_t&) {
+            return true; // the SC raises the proper exception
+        }
+    }
+
+    demo_core* const core;
+    reg_t reserved_addr{~reg_t(0)}; // virtual address of the last LR
+    uint64_t reserved_value{0};
+};
+
+void demo_core::set_parallel(bool enable) {
+    stop_workers();
+    parallel = enable && procs.size() > 1;
+    if (!parallel) {
+        return;
+    }
+    if (atomics.empty()) {
+        for (auto& proc : procs) {
+            atomics.push_back(std::make_unique<serialized_atomics>(this));
+            proc->register_extension(atomics.back().get());
+            // decoded instructions still point to Spike's implementations
+            proc->get_mmu()->flush_icache();
+        }
+    }
+    // hart 0 runs on the calling thread. Workers start at the current
+    // generation, quanta of earlier workers are not theirs to run
+    uint64_t gen;
+    {
+        std::lock_guard<std::mutex> lk(pool_lock);
+        workers_stop = false;
+        gen = quantum_gen;
+    }
+    for (size_t i = 1; i < procs.size(); i++) {
+        workers.emplace_back(&demo_core::worker_loop, this, i, gen);
+    }
+}
+
+void demo_core::stop_workers() {
+    {
+        std::lock_guard<std::mutex> lk(pool_lock);
+        workers_stop = true;
+    }
+    start_cv.notify_all();
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    workers.clear();
+    parallel = false;
+}
+
+void demo_core::worker_loop(size_t idx, uint64_t seen_gen) {
+    while (true) {
+        size_t n;
+        {
+            std::unique_lock<std::mutex> lk(pool_lock);
+            start_cv.wait(lk, [&] { return workers_stop || quantum_gen != seen_gen; });
+            if (workers_stop) {
+                return;
+            }
+            seen_gen = quantum_gen;
+            n = quantum;
+        }
+        {
+            HOST_PROF_SCOPE("processor_t::step");
+            procs[idx]->step(n);
+        }
+        {
+            std::lock_guard<std::mutex> lk(pool_lock);
+            if (--running == 0) {
+                done_cv.notify_one();
+            }
+        }
+    }
+}
+
+void demo_core::step_parallel(size_t n) {
+    {
+        std::lock_guard<std::mutex> lk(pool_lock);
+        quantum = n;
+        running = workers.size();
+        quantum_gen++;
+    }
+    start_cv.notify_all();
+    procs[0]->step(n);
+    {
+        std::unique_lock<std::mutex> lk(pool_lock);
+        done_cv.wait(lk, [&] { return running == 0; });
+    }
+    // quantum barrier: all harts are stopped, the next quantum starts without
+    // reservations as in sequential mode
+    for (auto& proc : procs) {
+        proc->get_mmu()->yield_load_reservation();
+    }
+}
@@ -18,18 +18,26 @@
 #include "riscv/simif.h"      // needed for base class
 #include "riscv/log_file.h"   // for log_file_t
 #include "riscv/debug_module.h"
+#include "util/quantum_controller.h"
+#include "util/symbol_index.h"
 
+#include <condition_variable>
 #include <map>
 #include <memory>
+#include <mutex>
+#include <thread>
 #include <vector>
 
 // Forward declarations
 class processor_t;
 class cfg_t;
 class bus_t;
+class abstract_device_t;
+class memory_simulator;
 class memory_sim_bridge;
 class remote_bitbang_t;
 class debug_module_config_t;
+namespace util { class pc_profiler; }
 
 
 class demo_core : public simif_t {
@@ -53,23 +61,131 @@ class demo_core : public simif_t {
     const char* get_symbol(uint64_t paddr) override;
     // end pure virtual functions
 
+    struct run_limits {
+        uint64_t max_instructions{0}; // summed over all harts (may overshoot by less than one per hart), 0 means no limit
+        double timeout{0};            // wall-clock seconds, 0 means no limit
+        uint64_t stop_pc{0};          // stop before hart 0 executes this pc, 0 means none
+    };
+
+    // aborted: a forked run died without reporting its status
+    enum class exit_reason { finisher, instruction_limit, timeout, stop_pc, aborted };
+
+    struct run_status {
+        exit_reason reason{exit_reason::finisher};
+        uint32_t exit_code{0};       // value the guest wrote to the finisher
+        std::vector<uint64_t> instret; // instructions retired per hart
+        uint64_t total_instret{0};
+        double wall_time{0};         // seconds
+        double mips{0};
+        bool passed() const { return reason == exit_reason::finisher && exit_code == 0x5555; }
+    };
+
     void set_rom();
     processor_t* get_core(size_t i);
     void reset();
     void step(size_t n);
+    // step until the guest writes the finisher or a limit is hit. The harts
+    // run whole quanta, at a stop_pc hart 0 stops before that instruction
+    // while the other harts finish their quantum
+    run_status run(const run_limits& limits = run_limits());
+
+    // bytes written to guest memory at the start of a forked run
+    struct memory_patch {
+        uint64_t addr;
+        std::vector<uint8_t> bytes;
+    };
+    // run once per set of patches, each run in a child process forked from the
+    // current state, e.g. after run() stopped at a pc. Children share the
+    // memory copy-on-write, patch it and run to completion; this object's
+    // state is left untouched, they take no periodic checkpoints. At most
+    // max_children run at the same time, 0 means one per host cpu. Results
+    // are in the order of variants
+    std::vector<run_status> fork_runs(const std::vector<std::vector<memory_patch>>& variants,
+                                      const run_limits& limits = run_limits(),
+                                      size_t max_children = 0);
+    // instructions per hart between checks in run(), fixed 5000 by default
+    util::quantum_controller& quantum() { return quantum_ctl; }
+    // symbols of the loaded program for get_symbol, pass to load_elf_file
+    util::symbol_index& symbol_table() { return symbols; }
     void enable_debug(bool enable = true);
     void configure_log(bool enable_log, bool enable_commitlog = false);
     FILE* get_log_file();
+    // memory simulator behind cfg->external_simulator, needed by run()
+    void set_memory(memory_simulator* mem_sim);
+    // let Spike access the memory simulator through host pointers
+    void set_direct_memory(bool enable = true);
+    // run each hart's quantum on its own thread. Harts meet at a barrier at the
+    // end of every step(n) and drop their LR reservations there. AMOs and
+    // LR/SC of all harts are serialized, and an SC fails once the reserved
+    // memory no longer holds the value its LR read, so a store of another hart
+    // breaks the reservation (up to ABA). Plain loads and stores through host
+    // pointers are not synchronized, like plain accesses on hardware
+    void set_parallel(bool enable = true);
+    // write the state of all harts and the memory simulator's contents to a
+    // checkpoint file (util/checkpoint.h), call between runs. A delta only
+    // holds the memory pages written since the previous checkpoint
+    void save_checkpoint(const std::string& file, bool delta = false);
+    // continue from a checkpoint instead of the reset vector. The harts must be
+    // configured as they were when the checkpoint was taken. Deltas are applied
+    // on top of the checkpoint they follow
+    void restore_checkpoint(const std::string& file);
+    // let run() save a checkpoint every interval instructions (all harts): a
+    // complete one to <file>.0, then deltas to <file>.1, <file>.2, ...
+    void set_periodic_checkpoints(const std::string& file, uint64_t interval);
+    // sample the pc and call stack of every hart about every interval
+    // instructions (util/pc_profiler.h), 0 stops sampling. Samples add up
+    // until the profiler is cleared
+    void enable_profiler(uint64_t interval = 10000);
+    util::pc_profiler* profiler() { return prof.get(); }
 
     private:
+        // Spike extension replacing the A extension's instructions in parallel mode
+        class serialized_atomics;
+        // memory tracer on hart 0 catching the fetch of run()'s stop_pc
+        class stop_pc_tracer;
+
+        // seen_gen: quantum_gen when the worker was started
+        void worker_loop(size_t idx, uint64_t seen_gen);
+        void step_parallel(size_t n);
+        void step_harts(size_t n);
+        void stop_workers();
+        // serializes simif callbacks while harts run in parallel
+        std::unique_lock<std::mutex> serialize();
+        // feeds device traffic into the quantum controller
+        void note_mmio(reg_t paddr);
+
         std::map<size_t, processor_t*> harts;
         std::vector<processor_t*> procs;
-        std::map<std::string, uint64_t> symbols;
+        util::symbol_index symbols;
         const cfg_t* const cfg;
         std::unique_ptr<bus_t> bus;
+        abstract_device_t* bus_fallback{nullptr};
+        memory_simulator* mem_sim{nullptr};
+        bool direct_mem{false};
+        util::quantum_controller quantum_ctl;
         bool debug{false};
         bool log{false};
         log_file_t log_file{"out.txt"}; // Default log file
+        // periodic checkpoints
+        std::string checkpoint_file;
+        uint64_t checkpoint_interval{0};
+        uint64_t next_checkpoint{0};  // instret summed over all harts
+        unsigned checkpoint_seq{0};
+        std::unique_ptr<util::pc_profiler> prof;
+        std::unique_ptr<stop_pc_tracer> stop_tracer; // registered with hart 0's mmu once used
+        // parallel mode
+        bool parallel{false};
+        std::mutex sim_lock;
+        std::mutex atomic_lock; // taken before sim_lock, never after it
+        std::vector<std::unique_ptr<serialized_atomics>> atomics;
+        std::vector<std::thread> workers;
+        std::mutex pool_lock;
+        std::condition_variable start_cv;
+        std::condition_variable done_cv;
+        uint64_t quantum_gen{0};
+        size_t quantum{0};
+        size_t running{0};
+        bool workers_stop{false};
         // for GDB
         remote_bitbang_t* remote_bitbang{nullptr};
     public:
@@ -16,13 +16,65 @@
 #include "memory_simulator.h"
 #include "riscv/cfg.h"
 #include "riscv/remote_bitbang.h"
+#include "util/pc_profiler.h"
+#include "util/host_prof.h"
+#include <algorithm>
 #include <filesystem>
+#include <fstream>
 #include <iostream>
+#include <sstream>
 
 #define START_PC 0x20000000
 // #define START_PC 0x10110000
 
 
+// prints the outcome of a run, returns whether it passed
+static bool report(const std::string& label, const demo_core::run_status& status) {
+    const char* reason = "finished";
+    if (status.reason == demo_core::exit_reason::instruction_limit) {
+        reason = "instruction limit reached";
+    } else if (status.reason == demo_core::exit_reason::timeout) {
+        reason = "timed out";
+    } else if (status.reason == demo_core::exit_reason::stop_pc) {
+        reason = "stopped";
+    } else if (status.reason == demo_core::exit_reason::aborted) {
+        reason = "aborted";
+    }
+    printf("%s: %s, %s (status 0x%x), %llu instructions in %.3f s, %.2f MIPS\n",
+           label.c_str(), status.passed() ? "PASS" : "FAIL", reason, status.exit_code,
+           (unsigned long long)status.total_instret, status.wall_time, status.mips);
+    for (size_t i = 0; i < status.instret.size(); i++) {
+        printf("  hart %zu: %llu instructions\n", i, (unsigned long long)status.instret[i]);
+    }
+    return status.passed();
+}
+
+// "0x..." is an address, anything else a symbol of the loaded ELF
+static bool resolve(const std::string& location, const std::map<std::string, uint64_t>& symbols,
+                    uint64_t* addr) {
+    if (location.find("0x") == 0) {
+        *addr = std::stoull(location, nullptr, 16);
+        return true;
+    }
+    auto it = symbols.find(location);
+    if (it == symbols.end()) {
+        return false;
+    }
+    *addr = it->second;
+    return true;
+}
+
+static std::vector<uint8_t> parse_hex(const std::string& hex) {
+    if (hex.size() % 2) {
+        throw std::invalid_argument("odd number of hex digits in " + hex);
+    }
+    std::vector<uint8_t> bytes;
+    for (size_t i = 0; i < hex.size(); i += 2) {
+        bytes.push_back(std::stoul(hex.substr(i, 2), nullptr, 16));
+    }
+    return bytes;
+}
+
 int main(int argc, char* argv[]) {
     // configuration time
     cfg_t cfg;
@@ -40,6 +92,25 @@ int main(int argc, char* argv[]) {
 
     uint16_t rbb_port = 0;
     bool use_rbb = false;
+    bool direct_mem = false;
+    bool map_elf = false;
+    bool parallel = false;
+    bool enable_debug = false;
+    demo_core::run_limits limits;
+    util::quantum_controller quantum;
+    std::vector<std::string> elf_files;
+    std::string checkpoint_file;
+    uint64_t checkpoint_after = 0;
+    uint64_t checkpoint_every = 0;
+    std::vector<std::string> restore_files;
+    std::string pause_at;
+    std::string fork_target;
+    std::vector<std::string> fork_values;
+    size_t fork_jobs = 0;
+    std::string profile_file;
+    uint64_t profile_interval = 10000;
+    bool host_prof = false;
+    std::string host_trace_file;
     unsigned dmi_rti = 0; // TODO: check if this should be parsed from command line
 
 
@@ -53,7 +124,110 @@ int main(int argc, char* argv[]) {
             } 
             std::cout << "RBB port set to " << rbb_port << std::endl;
             use_rbb = true;
+        } else if (arg == "--direct-mem") {
+            std::cout << "Direct memory access enabled" << std::endl;
+            direct_mem = true;
+        } else if (arg == "--map-elf") {
+            std::cout << "ELF segments mapped from the file" << std::endl;
+            map_elf = true;
+        } else if (arg.find("--harts=") == 0) {
+            size_t nharts = std::stoul(arg.substr(arg.find("=") + 1));
+            cfg.hartids.clear();
+            for (size_t i = 0; i < nharts; i++) {
+                cfg.hartids.push_back(i);
+            }
+            std::cout << "Number of harts set to " << nharts << std::endl;
+        } else if (arg == "--parallel") {
+            std::cout << "Parallel hart execution enabled" << std::endl;
+            parallel = true;
+        } else if (arg == "--debug" || arg == "-d") {
+            std::cout << "Debug logging enabled" << std::endl;
+            enable_debug = true;
+        } else if (arg.find("--max-instructions=") == 0) {
+            limits.max_instructions = std::stoull(arg.substr(arg.find("=") + 1));
+            std::cout << "Instruction budget set to " << limits.max_instructions << std::endl;
+        } else if (arg.find("--timeout=") == 0) {
+            limits.timeout = std::stod(arg.substr(arg.find("=") + 1));
+            std::cout << "Timeout set to " << limits.timeout << " s" << std::endl;
+        } else if (arg.find("--quantum=") == 0) {
+            if (!quantum.parse(arg.substr(arg.find("=") + 1))) {
+                std::cerr << "Error: invalid quantum " << arg << std::endl;
+                exit(1);
+            }
+            std::cout << "Quantum set to " << arg.substr(arg.find("=") + 1) << std::endl;
+        } else if (arg.find("--checkpoint=") == 0) {
+            checkpoint_file = arg.substr(arg.find("=") + 1);
+            std::cout << "Checkpoint written to " << checkpoint_file << std::endl;
+        } else if (arg.find("--checkpoint-after=") == 0) {
+            checkpoint_after = std::stoull(arg.substr(arg.find("=") + 1));
+            std::cout << "Checkpoint taken after " << checkpoint_after << " instructions" << std::endl;
+        } else if (arg.find("--checkpoint-every=") == 0) {
+            checkpoint_every = std::stoull(arg.substr(arg.find("=") + 1));
+            std::cout << "Checkpoint taken every " << checkpoint_every << " instructions" << std::endl;
+        } else if (arg.find("--restore=") == 0) {
+            // repeat to apply deltas on top of the first checkpoint
+            restore_files.push_back(arg.substr(arg.find("=") + 1));
+            std::cout << "Restoring from " << restore_files.back() << std::endl;
+        } else if (arg.find("--pause-at=") == 0) {
+            pause_at = arg.substr(arg.find("=") + 1);
+            std::cout << "Pausing at " << pause_at << std::endl;
+        } else if (arg.find("--fork=") == 0) {
+            // --fork=<location>=<hex>[,<hex>...]
+            const std::string spec = arg.substr(arg.find("=") + 1);
+            const size_t eq = spec.find("=");
+            if (eq == std::string::npos) {
+                std::cerr << "Error: invalid fork " << arg << std::endl;
+                exit(1);
+            }
+            fork_target = spec.substr(0, eq);
+            std::stringstream values(spec.substr(eq + 1));
+            for (std::string v; std::getline(values, v, ',');) {
+                fork_values.push_back(v);
+            }
+            std::cout << "Forking " << fork_values.size() << " runs patching " << fork_target << std::endl;
+        } else if (arg.find("--fork-jobs=") == 0) {
+            fork_jobs = std::stoul(arg.substr(arg.find("=") + 1));
+            std::cout << "Forked runs limited to " << fork_jobs << " at a time" << std::endl;
+        } else if (arg.find("--profile=") == 0) {
+            profile_file = arg.substr(arg.find("=") + 1);
+            std::cout << "Profile written to " << profile_file << std::endl;
+        } else if (arg.find("--profile-interval=") == 0) {
+            profile_interval = std::stoull(arg.substr(arg.find("=") + 1));
+            std::cout << "Profile sampled every " << profile_interval << " instructions" << std::endl;
+        } else if (arg == "--host-prof") {
+            std::cout << "Host profiling enabled" << std::endl;
+            host_prof = true;
+        } else if (arg.find("--host-trace=") == 0) {
+            host_trace_file = arg.substr(arg.find("=") + 1);
+            std::cout << "Host trace written to " << host_trace_file << std::endl;
+            host_prof = true;
+        } else if (arg.find("--") != 0) {
+            elf_files.push_back(arg);
+        }
+    }
+    // symbols for --pause-at and --fork after --restore
+    std::string symbol_elf;
+    if (!restore_files.empty()) {
+        // the checkpoint replaces loading an ELF, one given as well only provides the symbols
+        if (elf_files.size() > 1) {
+            std::cerr << "Error: --restore takes at most one ELF for its symbols" << std::endl;
+            exit(1);
         }
+        if (!elf_files.empty()) {
+            symbol_elf = elf_files.front();
+            if (!std::filesystem::exists(symbol_elf)) {
+                std::cerr << "Error: " << symbol_elf << " not found. Please build the software first.\n";
+                exit(1);
+            }
+            std::cout << "Symbols read from " << symbol_elf << std::endl;
+        }
+        elf_files = {restore_files.back()};
+    } else if (elf_files.empty()) {
+        elf_files.push_back("sw/main.elf");
+    }
+    if (!checkpoint_file.empty() && !checkpoint_after && !checkpoint_every) {
+        std::cerr << "Error: --checkpoint needs --checkpoint-after or --checkpoint-every" << std::endl;
+        exit(1);
     }
 
 
@@ -61,8 +235,10 @@ int main(int argc, char* argv[]) {
     #ifdef USE_BRIDGE
     memory_simulator mem_sim(1024 * 1024 * 1024, START_PC);
     memory_sim_bridge ext_sim(&mem_sim);
+    memory_simulator* backing_mem = &mem_sim;
     #else
     memory_simulator_wrapper ext_sim(1024 * 1024 * 1024, START_PC); // TODO: update naming
+    memory_simulator* backing_mem = &ext_sim;
     #endif
     // setting cfg field from external simulator
     cfg.external_simulator = &ext_sim;
@@ -76,23 +252,148 @@ int main(int argc, char* argv[]) {
       demo_riscv_core.set_remote_bitbang(&(*remote_bitbang));
     }
 
-
-    // this is runtime from this point
-    // first reset and load elf
-    demo_riscv_core.reset();
-    if (!std::filesystem::exists("sw/main.elf")) {
-        std::cerr << "Error: sw/main.elf not found. Please build the software first.\n";
-        exit(1);
+    demo_riscv_core.set_memory(backing_mem);
+    demo_riscv_core.set_direct_memory(direct_mem);
+    demo_riscv_core.set_parallel(parallel);
+    demo_riscv_core.quantum() = quantum;
+    if (checkpoint_every) {
+        demo_riscv_core.set_periodic_checkpoints(checkpoint_file, checkpoint_every);
     }
-    uint64_t entry_point;
-    ext_sim.load_elf_file("sw/main.elf", &entry_point);
-    assert(entry_point == START_PC);
+
     // enable debugging features
-    demo_riscv_core.enable_debug();
-    demo_riscv_core.configure_log(true, false);
+    if (enable_debug) {
+        demo_riscv_core.enable_debug();
+        demo_riscv_core.configure_log(true, false);
+    }
+
+    // flat profile on stdout, the folded stacks of every ELF go to one file
+    std::ofstream profile_out;
+    if (!profile_file.empty()) {
+        profile_out.open(profile_file);
+        demo_riscv_core.enable_profiler(profile_interval);
+    }
+    auto dump_profile = [&](const std::string& elf) {
+        if (auto* prof = demo_riscv_core.profiler()) {
+            prof->write_flat(stdout, demo_riscv_core.symbol_table(), 20);
+            prof->write_folded(profile_out, demo_riscv_core.symbol_table(), std::filesystem::path(elf).filename());
+            prof->clear();
+        }
+    };
+
+    if (host_prof) {
+        util::host_profiler::instance().enable(!host_trace_file.empty());
+    }
+
+    // this is runtime from this point
+    // every ELF runs on freshly reset harts and memory
+    int failures = 0;
+    for (const auto& elf : elf_files) {
+        if (!std::filesystem::exists(elf)) {
+            std::cerr << "Error: " << elf << " not found. Please build the software first.\n";
+            exit(1);
+        }
+        std::map<std::string, uint64_t> symbols;
+        if (!restore_files.empty()) {
+            for (const auto& file : restore_files) {
+                demo_riscv_core.restore_checkpoint(file);
+            }
+            demo_riscv_core.symbol_table().clear();
+            if (!symbol_elf.empty()) {
+                symbols = backing_mem->load_elf_symbols(symbol_elf, &demo_riscv_core.symbol_table());
+            }
+        } else {
+            backing_mem->reset_memory();
+            demo_riscv_core.symbol_table().clear();
+            uint64_t entry_point;
+            symbols = backing_mem->load_elf_file(elf, &entry_point, map_elf, &demo_riscv_core.symbol_table());
+            assert(entry_point == START_PC);
+            demo_riscv_core.reset();
+        }
 
-    while (1)
-        demo_riscv_core.step(5000);
+        const char* unknown_hint = symbols.empty() && !restore_files.empty()
+                                       ? " (pass the ELF along with --restore for its symbols)" : "";
+        if (!pause_at.empty()) {
+            demo_core::run_limits to_pause = limits;
+            if (!resolve(pause_at, symbols, &to_pause.stop_pc)) {
+                std::cerr << "Error: unknown symbol " << pause_at << unknown_hint << std::endl;
+                exit(1);
+            }
+            auto paused = demo_riscv_core.run(to_pause);
+            if (paused.reason != demo_core::exit_reason::stop_pc) {
+                report(elf + " (" + pause_at + " not reached)", paused);
+                dump_profile(elf);
+                failures++;
+                continue;
+            }
+            printf("%s: paused at %s after %llu instructions\n", elf.c_str(), pause_at.c_str(),
+                   (unsigned long long)paused.total_instret);
+        }
+
+        if (!fork_values.empty()) {
+            // one child per value, all starting from the current state
+            uint64_t addr;
+            if (!resolve(fork_target, symbols, &addr)) {
+                std::cerr << "Error: unknown symbol " << fork_target << unknown_hint << std::endl;
+                exit(1);
+            }
+            std::vector<std::vector<demo_core::memory_patch>> variants;
+            for (const auto& value : fork_values) {
+                variants.push_back({{addr, parse_hex(value)}});
+            }
+            auto results = demo_riscv_core.fork_runs(variants, limits, fork_jobs);
+            for (size_t i = 0; i < results.size(); i++) {
+                if (!report(elf + " [" + fork_target + "=" + fork_values[i] + "]", results[i])) {
+                    failures++;
+                }
+            }
+            dump_profile(elf);
+            continue;
+        }
+
+        demo_core::run_status status;
+        if (!checkpoint_file.empty() && !checkpoint_every) {
+            // run up to the checkpoint, save it and go on with what is left of the limits
+            demo_core::run_limits boot = limits;
+            boot.max_instructions = limits.max_instructions ? std::min(limits.max_instructions, checkpoint_after)
+                                                            : checkpoint_after;
+            auto first = demo_riscv_core.run(boot);
+            if (first.reason == demo_core::exit_reason::instruction_limit) {
+                demo_riscv_core.save_checkpoint(checkpoint_file);
+                std::cout << "Checkpoint saved after " << first.total_instret << " instructions" << std::endl;
+            }
+            status = first;
+            if (first.reason == demo_core::exit_reason::instruction_limit
+                && (!limits.max_instructions || first.total_instret < limits.max_instructions)) {
+                demo_core::run_limits rest = limits;
+                if (limits.max_instructions) {
+                    rest.max_instructions -= first.total_instret;
+                }
+                if (limits.timeout > 0) {
+                    rest.timeout = std::max(limits.timeout - first.wall_time, 1e-9);
+                }
+                status = demo_riscv_core.run(rest);
+                for (size_t i = 0; i < status.instret.size(); i++) {
+                    status.instret[i] += first.instret[i];
+                }
+                status.total_instret += first.total_instret;
+                status.wall_time += first.wall_time;
+                status.mips = status.wall_time > 0 ? status.total_instret / status.wall_time / 1e6 : 0;
+            }
+        } else {
+            status = demo_riscv_core.run(limits);
+        }
 
-    return 0;
+        if (!report(elf, status)) {
+            failures++;
+        }
+        dump_profile(elf);
+    }
+
+    if (host_prof) {
+        util::host_profiler::instance().report(stdout);
+        if (!host_trace_file.empty()) {
+            util::host_profiler::instance().write_trace(host_trace_file);
+        }
+    }
+    return failures ? 1 : 0;
 }
@@ -15,50 +15,121 @@
 
 
 #include "memory_simulator.h"
+#include "util/host_prof.h"
 #include <cstring>
 #include <cassert>
 
+#define SOC_SCR_FINISH 0x3fffb008
+
 memory_simulator::memory_simulator(uint64_t size, uint64_t start_pc): mem_size(size), start_pc(start_pc) {
     printf("creating memory_simulator\n");
     set_rom_contents();
+    mmio.add_region("finisher", SOC_SCR_FINISH, 4, [this](uint64_t, const uint8_t* data, size_t) {
+        const unsigned int testStatus = ((unsigned int*)data)[0];
+
+        if (testStatus != 0 && !exited) {
+          if (testStatus == 0x5555) {
+            printf("PASS\n");
+          } else {
+            printf("FAIL with status %x\n", testStatus);
+          }
+          exited = true;
+          exit_code = testStatus;
+        }
+        return false;
+    });
 }
 
 memory_simulator::~memory_simulator() {}
 
 void memory_simulator::write(uint64_t addr, const uint8_t* data, size_t len) {
+    HOST_PROF_SCOPE("memory_simulator::write");
+    if (unlikely(mmio.is_mmio_page(addr)) && mmio.write(addr, data, len)) {
+        return;
+    }
+    switch (len) {
+        case 1: mem_acc.write<1>(addr, data); break;
+        case 2: mem_acc.write<2>(addr, data); break;
+        case 4: mem_acc.write<4>(addr, data); break;
+        case 8: mem_acc.write<8>(addr, data); break;
+        case 16: mem_acc.write<16>(addr, data); break;
+        default: mem_acc.write(addr, data, len);
+    }
+}
 
-    if (unlikely(addr == 0x3fffb008)) {
-      const unsigned int testStatus = ((unsigned int*)data)[0];
+void memory_simulator::read(uint64_t addr, uint8_t* data, size_t len) {
+    HOST_PROF_SCOPE("memory_simulator::read");
+    if (unlikely(mmio.is_mmio_page(addr)) && mmio.read(addr, data, len)) {
+        return;
+    }
+    switch (len) {
+        case 1: mem_acc.read<1>(addr, data); break;
+        case 2: mem_acc.read<2>(addr, data); break;
+        case 4: mem_acc.read<4>(addr, data); break;
+        case 8: mem_acc.read<8>(addr, data); break;
+        case 16: mem_acc.read<16>(addr, data); break;
+        default: mem_acc.read(addr, data, len);
+    }
+}
 
-      if (testStatus != 0) {
-        if (testStatus == 0x5555) {
-          printf("PASS\n");
-        } else {
-          printf("FAIL with status %x\n", testStatus);
-        }
-        assert(0);
-      } 
-    } 
-    sparse_arr.write(addr, data, len);
+char* memory_simulator::get_ptr(uint64_t addr) {
+    if (is_mmio_page(addr)) {
+        return nullptr;
+    }
+    return sparse_arr.get_ptr(addr);
 }
 
-void memory_simulator::read(uint64_t addr, uint8_t* data, size_t len) {
-    sparse_arr.read(addr, data, len);
+void memory_simulator::add_mmio_range(uint64_t base, uint64_t size) {
+    mmio.add_region("mmio", base, size);
 }
 
-std::map<std::string, uint64_t> memory_simulator::load_elf_file(const std::string& filename, uint64_t* entry_point) {
+std::map<std::string, uint64_t> memory_simulator::load_elf_file(const std::string& filename, uint64_t* entry_point,
+                                                                bool map_file, util::symbol_index* symbols) {
     if (entry_point) {
-        return load_elf(filename.c_str(), &sparse_arr, entry_point);
+        return load_elf(filename.c_str(), &sparse_arr, entry_point, map_file, symbols);
     } else {
         uint64_t dummy_entry;
-        return load_elf(filename.c_str(), &sparse_arr, &dummy_entry);
+        return load_elf(filename.c_str(), &sparse_arr, &dummy_entry, map_file, symbols);
     }
 }
 
+std::map<std::string, uint64_t> memory_simulator::load_elf_symbols(const std::string& filename,
+                                                                   util::symbol_index* symbols) {
+    uint64_t entry_point;
+    return load_elf(filename.c_str(), static_cast<decltype(sparse_arr)*>(nullptr), &entry_point, false, symbols);
+}
+
 void memory_simulator::load_hex_file(const std::string& filename) {
     // TODO: Implement hex file loading
 }
 
+void memory_simulator::reset_memory() {
+    sparse_arr.clear();
+    set_rom_contents();
+    exited = false;
+    exit_code = 0;
+}
+
+void memory_simulator::save_state(util::checkpoint_writer& ckpt, bool delta) {
+    if (delta) {
+        ckpt.add_memory_delta("memdelta", sparse_arr);
+    } else {
+        ckpt.add_memory("mem", sparse_arr);
+    }
+    sparse_arr.clear_dirty();
+}
+
+void memory_simulator::restore_state(const util::checkpoint_reader& ckpt) {
+    if (ckpt.has("memdelta")) {
+        ckpt.apply_memory_delta("memdelta", sparse_arr);
+    } else {
+        ckpt.restore_memory("mem", sparse_arr);
+    }
+    sparse_arr.clear_dirty();
+    exited = false;
+    exit_code = 0;
+}
+
 uint64_t memory_simulator::size() const {
     return mem_size;
 }
@@ -137,6 +208,7 @@ bool memory_sim_bridge::store(reg_t addr, size_t len, const uint8_t* bytes) {
     return true;
 }
 
-void memory_sim_bridge::load_elf_file(const std::string& filename, uint64_t* entry_point) {
-    sim->load_elf_file(filename, entry_point);
+void memory_sim_bridge::load_elf_file(const std::string& filename, uint64_t* entry_point, bool map_file,
+                                      util::symbol_index* symbols) {
+    sim->load_elf_file(filename, entry_point, map_file, symbols);
 }
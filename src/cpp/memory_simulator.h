@@ -19,8 +19,11 @@
 #include <util/elf.h>
 #include <util/elfloader.h>
 #include <util/sparse_array.h>
+#include <util/mmio_regions.h>
+#include <util/checkpoint.h>
 #include <string>
 #include <map>
+#include <vector>
 #include <cstdint>
 #include "riscv/devices.h"
 
@@ -32,17 +35,52 @@ public:
 
     void write(uint64_t addr, const uint8_t* data, size_t len);
     void read(uint64_t addr, uint8_t* data, size_t len);
-    std::map<std::string, uint64_t> load_elf_file(const std::string& filename, uint64_t* entry_point = nullptr);
+    // map_file: take whole pages straight from a copy-on-write mapping of the file instead of copying them
+    // symbols: also add the ELF symbols with their sizes and types to this index
+    std::map<std::string, uint64_t> load_elf_file(const std::string& filename, uint64_t* entry_point = nullptr,
+                                                  bool map_file = false, util::symbol_index* symbols = nullptr);
+    // only the symbols of an ELF whose contents are already in memory, e.g. restored from a checkpoint
+    std::map<std::string, uint64_t> load_elf_symbols(const std::string& filename,
+                                                     util::symbol_index* symbols = nullptr);
     void load_hex_file(const std::string& filename); // not implemented yet
     uint64_t size() const;
+    uint64_t resident_bytes() const { return sparse_arr.resident_bytes(); }
     void set_rom_contents();
     void set_start_pc(uint64_t start_pc) { this->start_pc = start_pc; }
+    // drop all contents and rewrite the ROM, e.g. before loading the next ELF
+    void reset_memory();
+
+    // set once the guest wrote a non-zero status to the finisher
+    bool has_exited() const { return exited; }
+    uint32_t exit_status() const { return exit_code; }
+
+    // host pointer to the byte backing addr, or nullptr if the surrounding
+    // page overlaps an MMIO range and every access has to go through write/read
+    char* get_ptr(uint64_t addr);
+    // exclude [base, base + size) from direct host access
+    void add_mmio_range(uint64_t base, uint64_t size);
+    bool is_mmio_page(uint64_t addr) const { return mmio.is_mmio_page(addr); }
+    // device registers, e.g. the finisher; register more to add devices
+    util::mmio_region_table& mmio_regions() { return mmio; }
+
+    // memory contents as section "mem" of a checkpoint, restored pages are mapped from the file.
+    // A delta ("memdelta") only holds the pages written since the previous save_state or
+    // restore_state and is restored on top of that state. Host pointers from get_ptr have to be
+    // dropped after saving, writes through them are not tracked otherwise
+    void save_state(util::checkpoint_writer& ckpt, bool delta = false);
+    void restore_state(const util::checkpoint_reader& ckpt);
 
 protected:
     uint64_t mem_size;
     uint64_t start_pc;
+    bool exited{false};
+    uint32_t exit_code{0};
 private:
-    util::sparse_array<uint8_t, 18, 30> sparse_arr;
+    util::sparse_array<uint8_t, 36, 12> sparse_arr;
+    // read() and write() go through their own page cache. Not thread-safe, demo_core calls
+    // them under its sim_lock in parallel mode
+    util::sparse_array<uint8_t, 36, 12>::accessor mem_acc{sparse_arr};
+    util::mmio_region_table mmio;
 };
 
 /// one way is to create a wrapper class
@@ -68,7 +106,8 @@ public:
     bool load(reg_t addr, size_t len, uint8_t* bytes) override;
     bool store(reg_t addr, size_t len, const uint8_t* bytes) override;
 
-    void load_elf_file(const std::string& filename, uint64_t* entry_point = nullptr);
+    void load_elf_file(const std::string& filename, uint64_t* entry_point = nullptr, bool map_file = false,
+                       util::symbol_index* symbols = nullptr);
 
 private:
     memory_simulator* sim;
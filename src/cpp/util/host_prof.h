@@ -0,0 +1,324 @@
+// Copyright 2025 SiFive
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef _HOST_PROF_H_
+#define _HOST_PROF_H_
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+// Scoped timers, compiled out completely with -DHOST_PROF_ENABLE=0
+#ifndef HOST_PROF_ENABLE
+#define HOST_PROF_ENABLE 1
+#endif
+
+namespace util {
+
+/**
+ * @brief where the simulator spends host time, by named zones of code
+ *
+ * HOST_PROF_SCOPE("name") times the rest of the enclosing block. Every thread counts calls,
+ * inclusive and self time (inclusive minus nested zones) per zone in its own counters, so timing a
+ * zone costs two reads of the time stamp counter and no synchronization. While the profiler is
+ * disabled a zone costs one predictable branch.
+ *
+ * SystemC processes share one host thread. Code that lets the kernel run other processes while a
+ * zone is open must do so inside HOST_PROF_YIELD(), which takes the open zones off the thread
+ * until it returns and leaves the time spent elsewhere out of them.
+ *
+ * report() prints the breakdown, write_trace() the timed zones in the Chrome trace event format
+ * (chrome://tracing, Perfetto), if enabled with tracing.
+ */
+class host_profiler {
+public:
+    static constexpr unsigned max_zones = 64;
+    static constexpr size_t max_trace_events = 1 << 20; // per thread, later ones are dropped
+
+    static host_profiler& instance() {
+        static host_profiler profiler;
+        return profiler;
+    }
+
+#if defined(__x86_64__) || defined(__i386__)
+    static uint64_t ticks() { return __rdtsc(); }
+#else
+    static uint64_t ticks() { return std::chrono::steady_clock::now().time_since_epoch().count(); }
+#endif
+
+    static bool enabled() { return on.load(std::memory_order_relaxed); }
+
+    // start counting, with trace also record every timed zone for write_trace()
+    void enable(bool trace = false) {
+        tracing = trace;
+        start_ticks = ticks();
+        start_time = std::chrono::steady_clock::now();
+        on = true;
+    }
+
+    // id of a zone name, the same name always gets the same id
+    unsigned add_zone(const char* name) {
+        std::lock_guard<std::mutex> guard(lock);
+        for (unsigned i = 0; i < names.size(); i++) {
+            if (names[i] == name) {
+                return i;
+            }
+        }
+        if (names.size() == max_zones) {
+            return max_zones; // not counted
+        }
+        names.push_back(name);
+        return names.size() - 1;
+    }
+
+    class scope;
+    class yield;
+
+    struct thread_data {
+        struct zone_stats {
+            uint64_t calls;
+            uint64_t total;
+            uint64_t self;
+        };
+        struct event {
+            uint64_t start;
+            uint64_t duration;
+            unsigned zone;
+        };
+
+        unsigned id;
+        zone_stats zones[max_zones]{};
+        std::vector<event> events;
+        uint64_t dropped{0};
+        scope* current{nullptr}; // innermost open zone
+    };
+
+    // counters of the calling thread, they live as long as the profiler
+    thread_data& local() {
+        static thread_local thread_data* data = nullptr;
+        if (!data) {
+            std::lock_guard<std::mutex> guard(lock);
+            threads.push_back(std::make_unique<thread_data>());
+            data = threads.back().get();
+            data->id = threads.size() - 1;
+        }
+        return *data;
+    }
+
+    class scope {
+    public:
+        explicit scope(unsigned zone) {
+            if (!enabled() || zone >= max_zones) {
+                return;
+            }
+            data = &instance().local();
+            this->zone = zone;
+            parent = data->current;
+            data->current = this;
+            start = ticks();
+        }
+
+        ~scope() {
+            if (!data) {
+                return;
+            }
+            const uint64_t elapsed = ticks() - start;
+            auto& z = data->zones[zone];
+            z.calls++;
+            z.total += elapsed;
+            z.self += elapsed - children;
+            if (parent) {
+                parent->children += elapsed;
+            }
+            data->current = parent;
+            if (instance().tracing) {
+                if (data->events.size() < max_trace_events) {
+                    data->events.push_back({start, elapsed, zone});
+                } else {
+                    data->dropped++;
+                }
+            }
+        }
+
+        scope(const scope&) = delete;
+        scope& operator=(const scope&) = delete;
+
+    private:
+        friend class yield;
+        thread_data* data{nullptr};
+        scope* parent{nullptr};
+        uint64_t start{0};
+        uint64_t children{0};
+        unsigned zone{0};
+    };
+
+    class yield {
+    public:
+        yield() {
+            if (!enabled()) {
+                return;
+            }
+            data = &instance().local();
+            suspended = data->current;
+            data->current = nullptr;
+            start = ticks();
+        }
+
+        ~yield() {
+            if (!data) {
+                return;
+            }
+            // the open zones continue as if the time away had not passed
+            const uint64_t away = ticks() - start;
+            for (scope* s = suspended; s; s = s->parent) {
+                s->start += away;
+            }
+            data->current = suspended;
+        }
+
+        yield(const yield&) = delete;
+        yield& operator=(const yield&) = delete;
+
+    private:
+        thread_data* data{nullptr};
+        scope* suspended{nullptr};
+        uint64_t start{0};
+    };
+
+    struct zone {
+        explicit zone(const char* name) : id(instance().add_zone(name)) {}
+        const unsigned id;
+    };
+
+    /**
+     * per zone over all threads: calls, inclusive and self time and the share of the wall time since
+     * enable() spent in the zone itself. Shares add up to more than 100% with several busy threads.
+     * Call when the other threads are idle.
+     */
+    void report(FILE* out) {
+        std::lock_guard<std::mutex> guard(lock);
+        const double wall_ns = elapsed_ns();
+        const double ns_per_tick = this->ns_per_tick();
+        std::vector<thread_data::zone_stats> sum(names.size());
+        for (auto& t : threads) {
+            for (size_t i = 0; i < names.size(); i++) {
+                sum[i].calls += t->zones[i].calls;
+                sum[i].total += t->zones[i].total;
+                sum[i].self += t->zones[i].self;
+            }
+        }
+        std::vector<size_t> order;
+        for (size_t i = 0; i < names.size(); i++) {
+            if (sum[i].calls) {
+                order.push_back(i);
+            }
+        }
+        std::sort(order.begin(), order.end(), [&](size_t a, size_t b) { return sum[a].self > sum[b].self; });
+        fprintf(out, "host profile: %.3f s wall time, %zu threads\n", wall_ns / 1e9, threads.size());
+        fprintf(out, "%-36s %12s %11s %11s %9s %7s\n", "zone", "calls", "total ms", "self ms", "ns/call", "self%");
+        for (size_t i : order) {
+            fprintf(out, "%-36s %12llu %11.3f %11.3f %9.1f %6.2f%%\n", names[i].c_str(),
+                    (unsigned long long)sum[i].calls, sum[i].total * ns_per_tick / 1e6,
+                    sum[i].self * ns_per_tick / 1e6, sum[i].total * ns_per_tick / sum[i].calls,
+                    100.0 * sum[i].self * ns_per_tick / wall_ns);
+        }
+        // what no zone covers: the interpreter between accesses, the SystemC kernel, idle workers
+        for (auto& t : threads) {
+            uint64_t self = 0;
+            for (size_t i = 0; i < names.size(); i++) {
+                self += t->zones[i].self;
+            }
+            fprintf(out, "thread %u: %.2f%% of the wall time outside zones\n", t->id,
+                    std::max(0.0, 100.0 * (1 - self * ns_per_tick / wall_ns)));
+        }
+    }
+
+    // the recorded zones as complete ("X") events, one track per thread
+    void write_trace(const std::string& file) {
+        std::lock_guard<std::mutex> guard(lock);
+        std::ofstream os(file);
+        if (!os) {
+            throw std::runtime_error("cannot open trace file " + file);
+        }
+        const double us_per_tick = ns_per_tick() / 1e3;
+        os << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+        const char* sep = "\n";
+        char buf[256];
+        for (auto& t : threads) {
+            snprintf(buf, sizeof(buf), "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,"
+                     "\"args\":{\"name\":\"thread %u\"}}", sep, t->id, t->id);
+            os << buf;
+            sep = ",\n";
+            for (auto& e : t->events) {
+                snprintf(buf, sizeof(buf), ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+                         names[e.zone].c_str(), t->id, (int64_t)(e.start - start_ticks) * us_per_tick,
+                         e.duration * us_per_tick);
+                os << buf;
+            }
+            if (t->dropped) {
+                fprintf(stderr, "host trace: %llu events of thread %u dropped\n", (unsigned long long)t->dropped, t->id);
+            }
+        }
+        os << "\n]}\n";
+    }
+
+private:
+    double elapsed_ns() const {
+        return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start_time).count();
+    }
+
+    // time stamp counter rate, calibrated over the time since enable()
+    double ns_per_tick() const {
+        const uint64_t t = ticks() - start_ticks;
+        return t ? elapsed_ns() / t : 1.0;
+    }
+
+    static inline std::atomic<bool> on{false};
+    bool tracing{false};
+    uint64_t start_ticks{0};
+    std::chrono::steady_clock::time_point start_time;
+    std::mutex lock;
+    std::vector<std::string> names;
+    std::vector<std::unique_ptr<thread_data>> threads;
+};
+
+} // namespace util
+
+#define HOST_PROF_CONCAT2(a, b) a##b
+#define HOST_PROF_CONCAT(a, b) HOST_PROF_CONCAT2(a, b)
+
+#if HOST_PROF_ENABLE
+#define HOST_PROF_SCOPE(name)                                                                      \
+    static const util::host_profiler::zone HOST_PROF_CONCAT(host_prof_zone_, __LINE__)(name);      \
+    util::host_profiler::scope HOST_PROF_CONCAT(host_prof_scope_, __LINE__)(                       \
+        HOST_PROF_CONCAT(host_prof_zone_, __LINE__).id)
+#define HOST_PROF_YIELD() util::host_profiler::yield HOST_PROF_CONCAT(host_prof_yield_, __LINE__)
+#else
+#define HOST_PROF_SCOPE(name)
+#define HOST_PROF_YIELD()
+#endif
+
+#endif /* _HOST_PROF_H_ */
@@ -0,0 +1,210 @@
+// Copyright 2025 SiFive
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef _PC_PROFILER_H_
+#define _PC_PROFILER_H_
+
+#include "riscv/processor.h"
+#include <util/symbol_index.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <map>
+#include <ostream>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace util {
+
+/**
+ * @brief statistical profile of the guest, the pc and call stack of every hart sampled every few
+ * thousand instructions
+ *
+ * Spike has no cheap hook on calls and returns, so the call stack is unwound at sample time along
+ * the frame pointer chain. With -fno-omit-frame-pointer every frame saves ra at fp - XLEN/8 and the
+ * caller's fp at fp - 2 * XLEN/8, except leaf functions, which only save fp (at fp - XLEN/8) and
+ * still hold the return address in ra. For guest code without frame pointers only the sampled
+ * function is known. Stack addresses are read as physical, which is right for bare-metal guests.
+ *
+ * Samples are kept as raw addresses and only symbolized when the profile is written. The sample
+ * interval is jittered by up to +-50% so a loop whose length divides it is not always sampled at
+ * the same instruction.
+ */
+class pc_profiler {
+public:
+    // reads len (4 or 8) bytes of guest memory without side effects, false if addr is not memory
+    using reader = std::function<bool(uint64_t addr, void* data, size_t len)>;
+
+    pc_profiler(size_t harts, uint64_t interval = 10000, unsigned max_depth = 64)
+    : interval(std::max<uint64_t>(interval, 1))
+    , max_depth(std::max(max_depth, 1u))
+    , stacks(harts) {
+        for (size_t i = 0; i < harts; i++) {
+            countdown.push_back(next_interval());
+        }
+    }
+
+    uint64_t get_interval() const { return interval; }
+
+    // instructions hart may run before its next sample
+    uint64_t until_sample(size_t hart) const { return countdown[hart]; }
+
+    // hart ran n instructions, returns whether it is due for a sample
+    bool advance(size_t hart, uint64_t n) {
+        if (n < countdown[hart]) {
+            countdown[hart] -= n;
+            return false;
+        }
+        countdown[hart] = next_interval();
+        return true;
+    }
+
+    void sample(size_t hart, processor_t* p, const reader& read) {
+        state_t* s = p->get_state();
+        const unsigned w = p->get_xlen() / 8;
+        uint64_t sp = s->XPR[2], fp = s->XPR[8];
+        // a frame pointer lies above the stack pointer and not too far away
+        auto frame_pointer = [&](uint64_t v) { return v > sp && v - sp <= max_frame && v % w == 0; };
+        auto load = [&](uint64_t addr, uint64_t* v) {
+            *v = 0;
+            return read(addr, v, w);
+        };
+        scratch.assign(1, s->pc);
+        for (bool leaf = true; scratch.size() < max_depth && frame_pointer(fp); leaf = false) {
+            uint64_t saved_ra, saved_fp, ret, next;
+            if (!load(fp - w, &saved_ra)) {
+                break;
+            }
+            if (leaf && frame_pointer(saved_ra)) {
+                ret = s->XPR[1];
+                next = saved_ra;
+            } else if (load(fp - 2 * w, &saved_fp)) {
+                ret = saved_ra;
+                next = saved_fp;
+            } else {
+                break;
+            }
+            if (ret == 0) {
+                break;
+            }
+            scratch.push_back(ret - 1); // the call, not the instruction after it
+            sp = fp;
+            fp = next;
+        }
+        stacks[hart][scratch]++;
+        total++;
+    }
+
+    uint64_t samples() const { return total; }
+
+    void clear() {
+        for (auto& s : stacks) {
+            s.clear();
+        }
+        total = 0;
+    }
+
+    /**
+     * functions by the share of samples they were sampled in (self) or on the stack of (total)
+     *
+     * @param max_rows  rows with the most self samples to write, 0 for all
+     */
+    void write_flat(FILE* out, const symbol_index& symbols, size_t max_rows = 0) const {
+        std::map<std::string, std::pair<uint64_t, uint64_t>> rows; // name -> self, total
+        std::set<std::string> seen;
+        for (auto& hart : stacks) {
+            for (auto& [stack, count] : hart) {
+                rows[name_of(symbols, stack[0])].first += count;
+                seen.clear();
+                for (uint64_t addr : stack) {
+                    std::string name = name_of(symbols, addr);
+                    if (seen.insert(name).second) {
+                        rows[name].second += count; // recursion counts once
+                    }
+                }
+            }
+        }
+        std::vector<std::pair<std::string, std::pair<uint64_t, uint64_t>>> sorted(rows.begin(), rows.end());
+        std::sort(sorted.begin(), sorted.end(), [](const auto& a, const auto& b) { return a.second > b.second; });
+        if (max_rows && sorted.size() > max_rows) {
+            sorted.resize(max_rows);
+        }
+        fprintf(out, "%llu samples, one every %llu instructions per hart on average\n",
+                (unsigned long long)total, (unsigned long long)interval);
+        fprintf(out, "  self%%      self   total%%  function\n");
+        for (auto& [name, counts] : sorted) {
+            fprintf(out, "%6.2f%% %9llu  %6.2f%%  %s\n", percent(counts.first), (unsigned long long)counts.first,
+                    percent(counts.second), name.c_str());
+        }
+    }
+
+    /**
+     * one line "root;hart<n>;outermost;...;sampled <count>" per distinct stack, the input format of
+     * flamegraph.pl and speedscope
+     */
+    void write_folded(std::ostream& out, const symbol_index& symbols, const std::string& root = "") const {
+        for (size_t i = 0; i < stacks.size(); i++) {
+            std::map<std::string, uint64_t> folded;
+            for (auto& [stack, count] : stacks[i]) {
+                std::string line = root.empty() ? "" : root + ";";
+                line += "hart" + std::to_string(i);
+                for (auto it = stack.rbegin(); it != stack.rend(); ++it) {
+                    line += ";" + name_of(symbols, *it);
+                }
+                folded[line] += count;
+            }
+            for (auto& [line, count] : folded) {
+                out << line << " " << count << "\n";
+            }
+        }
+    }
+
+private:
+    static constexpr uint64_t max_frame = 1 << 20;
+
+    uint64_t next_interval() {
+        // xorshift64
+        rng ^= rng << 13;
+        rng ^= rng >> 7;
+        rng ^= rng << 17;
+        return std::max<uint64_t>(interval / 2 + rng % (interval + 1), 1);
+    }
+
+    static std::string name_of(const symbol_index& symbols, uint64_t addr) {
+        if (auto sym = symbols.find(addr)) {
+            return sym->name;
+        }
+        char hex[24];
+        snprintf(hex, sizeof(hex), "0x%llx", (unsigned long long)addr);
+        return hex;
+    }
+
+    double percent(uint64_t n) const { return total ? 100.0 * n / total : 0; }
+
+    uint64_t interval;
+    unsigned max_depth;
+    uint64_t rng{0x9e3779b97f4a7c15};
+    uint64_t total{0};
+    std::vector<uint64_t> countdown;
+    std::vector<std::map<std::vector<uint64_t>, uint64_t>> stacks; // per hart: sampled pc first
+    std::vector<uint64_t> scratch;
+};
+
+} // namespace util
+
+#endif /* _PC_PROFILER_H_ */
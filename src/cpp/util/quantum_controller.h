@@ -0,0 +1,107 @@
+// Copyright 2025 SiFive
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef _QUANTUM_CONTROLLER_H_
+#define _QUANTUM_CONTROLLER_H_
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+
+namespace util {
+
+/**
+ * @brief number of instructions each hart runs between two synchronization points
+ *
+ * A fixed controller always returns the same quantum. An adaptive one doubles the quantum after
+ * every quiet quantum up to max, halves it for every quantum that saw device traffic and drops it
+ * straight to min when something needs a prompt reaction (debugger, pending interrupt).
+ */
+class quantum_controller {
+public:
+    explicit quantum_controller(size_t quantum = 5000) { set_fixed(quantum); }
+
+    void set_fixed(size_t quantum) {
+        cur = min_q = max_q = std::max<size_t>(quantum, 1);
+    }
+
+    void set_adaptive(size_t min_quantum, size_t max_quantum) {
+        min_q = std::max<size_t>(min_quantum, 1);
+        max_q = std::max(max_quantum, min_q);
+        cur = min_q;
+    }
+
+    bool is_adaptive() const { return min_q != max_q; }
+
+    size_t get() const { return cur; }
+
+    // device traffic seen during the current quantum
+    inline void note_activity() { activity = true; }
+
+    // something is waiting, run the next quantum at the minimum size
+    inline void request_min() { urgent = true; }
+
+    // called at the end of every quantum, returns the size of the next one
+    size_t next() {
+        if (urgent) {
+            cur = min_q;
+        } else if (activity) {
+            cur = std::max(min_q, cur / 2);
+        } else {
+            cur = std::min(max_q, cur * 2);
+        }
+        activity = urgent = false;
+        return cur;
+    }
+
+    /**
+     * configure from a command line value: "<n>" for a fixed quantum, "adaptive" or
+     * "adaptive:<min>:<max>" for an adaptive one
+     *
+     * @return false if the value could not be parsed
+     */
+    bool parse(const std::string& spec) {
+        try {
+            if (spec.rfind("adaptive", 0) == 0) {
+                size_t min_quantum = 100, max_quantum = 100000;
+                if (spec.size() > 8) {
+                    const size_t sep = spec.find(':', 9);
+                    if (spec[8] != ':' || sep == std::string::npos)
+                        return false;
+                    min_quantum = std::stoul(spec.substr(9, sep - 9));
+                    max_quantum = std::stoul(spec.substr(sep + 1));
+                }
+                set_adaptive(min_quantum, max_quantum);
+            } else {
+                set_fixed(std::stoul(spec));
+            }
+        } catch (const std::exception&) {
+            return false;
+        }
+        return true;
+    }
+
+private:
+    size_t cur{5000};
+    size_t min_q{5000};
+    size_t max_q{5000};
+    bool activity{false};
+    bool urgent{false};
+};
+
+} // namespace util
+
+#endif /* _QUANTUM_CONTROLLER_H_ */
@@ -17,8 +17,15 @@
 #ifndef _SPARSE_ARRAY_H_
 #define _SPARSE_ARRAY_H_
 
+#include <algorithm>
 #include <array>
 #include <cassert>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <new>
+#include <sys/mman.h>
+#include <vector>
 
 /**
  * \ingroup scc-common
@@ -32,16 +39,30 @@ namespace util {
  *
  *  a simple array which allocates memory in configurable chunks (size of 2^lower_width), used for
  *  large sparse arrays. Memory is allocated on demand
+ *
+ *  The page number (upper_width bits) is translated through a two-level table: a directory indexed
+ *  by the upper half of the page number pointing to second-level tables holding the page pointers.
+ *  Directory, tables and pages all come from anonymous mappings, so the kernel zero-fills them
+ *  lazily and only the touched part of the address span ever becomes resident.
+ *
+ *  Every second-level table carries a dirty bitmap for its pages. Writes through the array and
+ *  get_ptr set the bit of their page, so incremental snapshots only need the pages returned by
+ *  for_each_dirty_page since the last clear_dirty.
+ *
+ *  The array is not thread-safe. Its own accesses, const reads included, go through one page cache
+ *  held by the array, so all of them need to be serialized by the caller. An accessor brings its
+ *  own cache: accessors used by different threads may read concurrently, but anything that writes
+ *  (it may allocate pages) or clears the array needs exclusive access.
  */
 template <typename T, int upper_width, int lower_width> class sparse_array {
 public:
-    const uint64_t page_addr_mask = (1 << lower_width) - 1;
+    const uint64_t page_addr_mask = (uint64_t(1) << lower_width) - 1;
 
-    const uint64_t page_size = (1 << lower_width);
+    const uint64_t page_size = (uint64_t(1) << lower_width);
 
     const uint64_t SIZE = (page_size << upper_width);
 
-    const unsigned page_count = 1 << upper_width ; // 1 + SIZE / page_size;
+    const uint64_t page_count = uint64_t(1) << upper_width;
 
     const uint64_t page_addr_width = lower_width;
 
@@ -49,14 +70,17 @@ public:
     /**
      * the default constructor
      */
-    sparse_array() { arr.fill(nullptr); }
+    sparse_array() { dir = static_cast<table_type**>(map_zeroed(sizeof(table_type*) << dir_width)); }
     /**
      * the destructor
      */
     ~sparse_array() {
-        for(auto i : arr)
-            delete i;
+        clear();
+        munmap(dir, sizeof(table_type*) << dir_width);
     }
+
+    sparse_array(const sparse_array&) = delete;
+    sparse_array& operator=(const sparse_array&) = delete;
     /**
      * element access operator
      *
@@ -65,12 +89,7 @@ public:
      */
     T& operator[](uint64_t addr) {
         assert(addr < SIZE);
-        uint64_t nr = addr >> lower_width;
-        assert(nr < page_count);
-        if(arr[nr] == nullptr) {
-            arr[nr] = new page_type();
-        }
-        return arr[nr]->at(addr & page_addr_mask);
+        return (*get_page(addr >> lower_width))[addr & page_addr_mask];
     }
     /**
      * page fetch operator
@@ -78,13 +97,9 @@ public:
      * @param page_nr the page number ot fetch
      * @return reference to page
      */
-    page_type& operator()(uint32_t page_nr) {
+    page_type& operator()(uint64_t page_nr) {
         assert(page_nr < page_count);
-        if(arr[page_nr] == nullptr) {
-            printf("sparse array is creating new page\n");
-            arr.at(page_nr) = new page_type();
-        }
-        return *(arr[page_nr]);
+        return *get_page(page_nr);
     }
     /**
      * check if page for address is allocated
@@ -92,10 +107,9 @@ public:
      * @param addr the address to check
      * @return true if the page is allocated
      */
-    bool is_allocated(uint64_t addr) {
+    bool is_allocated(uint64_t addr) const {
         assert(addr < SIZE);
-        uint64_t nr = addr >> lower_width;
-        return arr.at(nr) != nullptr;
+        return find_page(addr >> lower_width) != nullptr;
     }
     /**
      * get the size of the array
@@ -103,59 +117,402 @@ public:
      * @return the size
      */
     uint64_t size() { return SIZE; }
+    /**
+     * get the number of bytes held by allocated pages
+     *
+     * @return the resident size in bytes
+     */
+    uint64_t resident_bytes() const { return allocated_pages * sizeof(page_type); }
+    /**
+     * release all pages, the whole array reads as zero afterwards. Pointers returned by get_ptr
+     * and the page caches of accessors are invalidated.
+     */
+    void clear() {
+        for(auto i : used_tables) {
+            munmap(dir[i], sizeof(table_type));
+            dir[i] = nullptr;
+        }
+        used_tables.clear();
+        for(auto& m : mappings)
+            munmap(m.first, m.second);
+        mappings.clear();
+        chunk_next = nullptr;
+        chunk_left = 0;
+        allocated_pages = 0;
+        tlb = page_cache();
+        for(auto* acc : accessors)
+            acc->cache = page_cache();
+    }
 
-    void write(uint64_t addr, const uint8_t *data_ptr, size_t data_len, uint8_t *be_ptr = nullptr, size_t be_len = 0) {
-        // fmt::print("\n{:10x}", addr);
-        
-        assert(addr < SIZE);
-        const uint32_t total_page_writes = ((addr & page_addr_mask) + data_len) / page_size + 1;
-        uint64_t start_addr = addr;
-
-        for (int i = 0; i < total_page_writes; i++) {
-            const uint32_t page_nr = start_addr / page_size;
-            assert(page_nr < page_count);
-            if (arr.at(page_nr) == nullptr) {
-                arr.at(page_nr) = new page_type();
-            }
-            page_type& page = *(arr.at(page_nr));
-            const auto offset = start_addr & page_addr_mask;
-            size_t written_len = data_len;
-            
-            if ((offset + data_len) > page_size) {
-                written_len = page_size - offset;
-                data_len -= written_len;
-                start_addr += written_len;
+    /**
+     * fixed size access of N bytes (1, 2, 4, 8 or 16), served from the page cache when the access
+     * does not cross a page boundary
+     */
+    template <size_t N> void read(uint64_t addr, uint8_t *data_ptr) const {
+        if (__builtin_expect((addr & page_addr_mask) + N <= page_size, 1)) {
+            if (const T* page = lookup_page(tlb, addr >> lower_width)) {
+                std::memcpy(data_ptr, page + (addr & page_addr_mask), N);
+            } else {
+                std::memset(data_ptr, 0, N);
             }
+            return;
+        }
+        read_range(addr, data_ptr, N);
+    }
+
+    template <size_t N> void write(uint64_t addr, const uint8_t *data_ptr) {
+        if (__builtin_expect((addr & page_addr_mask) + N <= page_size, 1)) {
+            std::memcpy(lookup_page_alloc(tlb, addr >> lower_width) + (addr & page_addr_mask), data_ptr, N);
+            return;
+        }
+        write(addr, data_ptr, N);
+    }
 
+    void write(uint64_t addr, const uint8_t *data_ptr, size_t data_len, uint8_t *be_ptr = nullptr, size_t be_len = 0) {
+        if (be_ptr == nullptr && (addr & page_addr_mask) + data_len <= page_size) {
+            std::memcpy(lookup_page_alloc(tlb, addr >> lower_width) + (addr & page_addr_mask), data_ptr, data_len);
+            return;
+        }
+        assert(addr + data_len <= SIZE);
+        size_t done = 0;
+        while (done < data_len) {
+            page_type& page = *get_page(addr >> lower_width);
+            const auto offset = addr & page_addr_mask;
+            const size_t written_len = std::min<size_t>(data_len - done, page_size - offset);
             auto page_start = page.data() + offset;
 
             if (be_ptr == nullptr || be_len == 0) { // byte enable not used
-                std::copy(data_ptr, data_ptr + written_len, page_start);
+                std::copy(data_ptr + done, data_ptr + done + written_len, page_start);
             } else {
-                for (int i = 0; i < written_len; i++){
-                    if(be_ptr[i % be_len] == 0xFF){ // 0x00 and 0xFF are only defined
-                        *(page_start+i) = *(data_ptr+i);
-                    } 
+                for (size_t i = 0; i < written_len; i++){
+                    if(be_ptr[(done + i) % be_len] == 0xFF){ // 0x00 and 0xFF are only defined
+                        *(page_start+i) = *(data_ptr+done+i);
+                    }
                 }
             }
+            done += written_len;
+            addr += written_len;
+        }
+    }
+
+    /**
+     * read len bytes starting at addr, unallocated pages read as zero and are not allocated
+     */
+    void read(uint64_t addr, uint8_t *data_ptr, size_t len) const {
+        if ((addr & page_addr_mask) + len <= page_size) {
+            if (const T* page = lookup_page(tlb, addr >> lower_width)) {
+                std::memcpy(data_ptr, page + (addr & page_addr_mask), len);
+            } else {
+                std::memset(data_ptr, 0, len);
+            }
+            return;
+        }
+        read_range(addr, data_ptr, len);
+    }
+    /**
+     * bulk read, copies whole pages at a time and may span any number of pages
+     */
+    void read_range(uint64_t addr, uint8_t *data_ptr, size_t len) const {
+        assert(addr + len <= SIZE);
+        size_t done = 0;
+        while (done < len) {
+            const page_type* page = find_page(addr >> lower_width);
+            const auto offs = addr & page_addr_mask;
+            const size_t read_len = std::min<size_t>(len - done, page_size - offs);
+            const T* src = (page ? page->data() : zero_page.data()) + offs;
+            std::copy(src, src + read_len, data_ptr + done);
+            done += read_len;
+            addr += read_len;
+        }
+    }
+    /**
+     * bulk write, copies whole pages at a time; chunks of zeros destined for unallocated pages are
+     * skipped since those already read as zero
+     */
+    void write_range(uint64_t addr, const uint8_t *data_ptr, size_t len) {
+        assert(addr + len <= SIZE);
+        size_t done = 0;
+        while (done < len) {
+            const auto offs = addr & page_addr_mask;
+            const size_t written_len = std::min<size_t>(len - done, page_size - offs);
+            const uint8_t* src = data_ptr + done;
+            if (find_page(addr >> lower_width) != nullptr
+                || std::any_of(src, src + written_len, [](uint8_t b) { return b != 0; })) {
+                std::copy(src, src + written_len, get_page(addr >> lower_width)->data() + offs);
+            }
+            done += written_len;
+            addr += written_len;
         }
     }
 
-    void read(uint64_t addr, uint8_t *data_ptr, size_t len) {
-        // fmt::print("\n{:10x}", addr);
+    /**
+     * call f(page_nr, page) for every allocated page, in ascending page order
+     */
+    template <typename F> void for_each_page(F f) const {
+        std::vector<uint64_t> tables(used_tables);
+        std::sort(tables.begin(), tables.end());
+        for(auto i : tables) {
+            const table_type* t = dir[i];
+            for(uint64_t j = 0; j <= table_mask; j++) {
+                if(t->pages[j])
+                    f((i << table_width) | j, *t->pages[j]);
+            }
+        }
+    }
+    /**
+     * use page as the backing of page_nr instead of allocating one, e.g. a page of a file mapping.
+     * The page must not be allocated yet.
+     */
+    void attach_page(uint64_t page_nr, page_type* page) {
+        page_type*& slot = table_for(page_nr)->pages[page_nr & table_mask];
+        assert(slot == nullptr);
+        slot = page;
+        allocated_pages++;
+    }
+    /**
+     * hand a mapping holding attached pages over to the array, it is unmapped by clear()
+     */
+    void adopt_mapping(void* addr, size_t len) { mappings.emplace_back(addr, len); }
+
+    /**
+     * call f(page_nr, page) for every page written since the last clear_dirty, in ascending page
+     * order
+     */
+    template <typename F> void for_each_dirty_page(F f) const {
+        std::vector<uint64_t> tables(used_tables);
+        std::sort(tables.begin(), tables.end());
+        for(auto i : tables) {
+            const table_type* t = dir[i];
+            for(uint64_t w = 0; w < dirty_words; w++) {
+                for(uint64_t bits = t->dirty[w]; bits; bits &= bits - 1) {
+                    const uint64_t j = w * 64 + __builtin_ctzll(bits);
+                    f((i << table_width) | j, *t->pages[j]);
+                }
+            }
+        }
+    }
+    /**
+     * number of pages written since the last clear_dirty
+     */
+    uint64_t dirty_pages() const {
+        uint64_t n = 0;
+        for(auto i : used_tables)
+            for(uint64_t w = 0; w < dirty_words; w++)
+                n += __builtin_popcountll(dir[i]->dirty[w]);
+        return n;
+    }
+    /**
+     * start a new snapshot interval. Writes through host pointers handed out by get_ptr before are
+     * not seen anymore, so whoever holds such pointers (DMI, Spike's TLB) has to drop them.
+     */
+    void clear_dirty() {
+        for(auto i : used_tables)
+            std::memset(dir[i]->dirty, 0, sizeof(dir[i]->dirty));
+    }
+
+    /**
+     * zero len bytes starting at addr, unallocated pages already read as zero and stay unallocated
+     */
+    void zero_range(uint64_t addr, size_t len) {
+        assert(addr + len <= SIZE);
+        while (len > 0) {
+            const auto offs = addr & page_addr_mask;
+            const size_t n = std::min<size_t>(len, page_size - offs);
+            if (find_page(addr >> lower_width) != nullptr) {
+                std::memset(get_page(addr >> lower_width)->data() + offs, 0, n * sizeof(T));
+            }
+            addr += n;
+            len -= n;
+        }
+    }
+
+    /**
+     * host pointer to addr, allocating its page. The page counts as written since the pointer may
+     * be used for writes.
+     */
+    char* get_ptr(uint64_t addr) {
         assert(addr < SIZE);
-        const uint32_t page_nr = addr / page_size;
+        return (char*)get_page(addr >> lower_width)->data() + (addr & page_addr_mask);
+    }
+
+    /**
+     * direct-mapped cache of recently used page pointers. Only allocated pages are cached and pages
+     * never move, so entries stay valid until the array is cleared.
+     */
+    struct page_cache {
+        static constexpr unsigned entries = 16;
+        struct entry {
+            uint64_t tag{~uint64_t(0)};
+            T* page{nullptr};
+            uint64_t* dirty{nullptr}; // word of the page's dirty bit
+            uint64_t dirty_bit{0};
+        };
+        entry e[entries];
+    };
+
+    /**
+     * an accessor owns its own page cache, so several clients (e.g. one per hart) can access the
+     * array without thrashing each other's entries. An accessor is used by one thread at a time,
+     * see the class description for concurrent accessors. Creating and destroying accessors needs
+     * exclusive access to the array, which resets their caches when it is cleared.
+     */
+    class accessor {
+    public:
+        explicit accessor(sparse_array& arr) : arr(arr) { arr.accessors.push_back(this); }
+        ~accessor() { arr.accessors.erase(std::find(arr.accessors.begin(), arr.accessors.end(), this)); }
+
+        accessor(const accessor&) = delete;
+        accessor& operator=(const accessor&) = delete;
+
+        template <size_t N> void read(uint64_t addr, uint8_t *data_ptr) {
+            if (__builtin_expect((addr & arr.page_addr_mask) + N <= arr.page_size, 1)) {
+                if (const T* page = arr.lookup_page(cache, addr >> lower_width)) {
+                    std::memcpy(data_ptr, page + (addr & arr.page_addr_mask), N);
+                } else {
+                    std::memset(data_ptr, 0, N);
+                }
+                return;
+            }
+            arr.read_range(addr, data_ptr, N);
+        }
+
+        template <size_t N> void write(uint64_t addr, const uint8_t *data_ptr) {
+            if (__builtin_expect((addr & arr.page_addr_mask) + N <= arr.page_size, 1)) {
+                std::memcpy(arr.lookup_page_alloc(cache, addr >> lower_width) + (addr & arr.page_addr_mask), data_ptr, N);
+                return;
+            }
+            arr.write(addr, data_ptr, N);
+        }
+
+        void read(uint64_t addr, uint8_t *data_ptr, size_t len) {
+            if (__builtin_expect((addr & arr.page_addr_mask) + len <= arr.page_size, 1)) {
+                if (const T* page = arr.lookup_page(cache, addr >> lower_width)) {
+                    std::memcpy(data_ptr, page + (addr & arr.page_addr_mask), len);
+                } else {
+                    std::memset(data_ptr, 0, len);
+                }
+                return;
+            }
+            arr.read_range(addr, data_ptr, len);
+        }
+
+        void write(uint64_t addr, const uint8_t *data_ptr, size_t len) {
+            if (__builtin_expect((addr & arr.page_addr_mask) + len <= arr.page_size, 1)) {
+                std::memcpy(arr.lookup_page_alloc(cache, addr >> lower_width) + (addr & arr.page_addr_mask),
+                            data_ptr, len);
+                return;
+            }
+            arr.write(addr, data_ptr, len);
+        }
+
+    private:
+        sparse_array& arr;
+        page_cache cache;
+        friend class sparse_array;
+    };
+
+protected:
+    // page pointer for page_nr through the cache, nullptr if the page is not allocated
+    const T* lookup_page(page_cache& c, uint64_t page_nr) const {
+        auto& e = c.e[page_nr % page_cache::entries];
+        if (__builtin_expect(e.tag == page_nr, 1))
+            return e.page;
+        if (page_type* page = find_page(page_nr)) {
+            fill(e, page_nr, page);
+            return e.page;
+        }
+        return nullptr;
+    }
+
+    // page pointer for page_nr through the cache for a write, allocating the page on a miss
+    T* lookup_page_alloc(page_cache& c, uint64_t page_nr) {
+        auto& e = c.e[page_nr % page_cache::entries];
+        if (__builtin_expect(e.tag == page_nr, 1)) {
+            *e.dirty |= e.dirty_bit;
+            return e.page;
+        }
+        fill(e, page_nr, get_page(page_nr));
+        return e.page;
+    }
+
+    void fill(typename page_cache::entry& e, uint64_t page_nr, page_type* page) const {
+        e.tag = page_nr;
+        e.page = page->data();
+        e.dirty = &dir[page_nr >> table_width]->dirty[(page_nr & table_mask) / 64];
+        e.dirty_bit = uint64_t(1) << ((page_nr & table_mask) % 64);
+    }
+
+    static constexpr int dir_width = upper_width / 2;
+    static constexpr int table_width = upper_width - dir_width;
+    static constexpr uint64_t table_mask = (uint64_t(1) << table_width) - 1;
+    // pages are carved out of mappings of at least this size
+    static constexpr size_t chunk_size = sizeof(page_type) > (size_t(2) << 20) ? sizeof(page_type) : (size_t(2) << 20);
+
+    // backs reads of unallocated pages
+    alignas(4096) static inline const page_type zero_page{};
+
+    static constexpr uint64_t dirty_words = ((uint64_t(1) << table_width) + 63) / 64;
+
+    struct table_type {
+        page_type* pages[uint64_t(1) << table_width];
+        uint64_t dirty[dirty_words];
+    };
+
+    static void* map_zeroed(size_t len) {
+        void* p = mmap(nullptr, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (p == MAP_FAILED)
+            throw std::bad_alloc();
+        return p;
+    }
+
+    page_type* find_page(uint64_t page_nr) const {
+        assert(page_nr < page_count);
+        const table_type* t = dir[page_nr >> table_width];
+        return t ? t->pages[page_nr & table_mask] : nullptr;
+    }
+
+    table_type* table_for(uint64_t page_nr) {
         assert(page_nr < page_count);
-        if (arr.at(page_nr) == nullptr) {
-            arr.at(page_nr) = new page_type();
+        table_type*& t = dir[page_nr >> table_width];
+        if (t == nullptr) {
+            t = static_cast<table_type*>(map_zeroed(sizeof(table_type)));
+            used_tables.push_back(page_nr >> table_width);
         }
-        page_type& page = *(arr.at(page_nr));
-        const auto offs = addr & page_addr_mask;
-        std::copy(page.data() + offs, page.data() + offs + len, data_ptr);
+        return t;
     }
 
-protected:
-    std::array<page_type*, (1 << upper_width) + 1> arr;
+    // page for a write, allocated if needed and marked dirty
+    page_type* get_page(uint64_t page_nr) {
+        table_type* t = table_for(page_nr);
+        page_type*& page = t->pages[page_nr & table_mask];
+        if (page == nullptr) {
+            page = alloc_page();
+        }
+        t->dirty[(page_nr & table_mask) / 64] |= uint64_t(1) << ((page_nr & table_mask) % 64);
+        return page;
+    }
+
+    page_type* alloc_page() {
+        if (chunk_left == 0) {
+            chunk_next = static_cast<uint8_t*>(map_zeroed(chunk_size));
+            mappings.emplace_back(chunk_next, chunk_size);
+            chunk_left = chunk_size / sizeof(page_type);
+        }
+        auto* page = reinterpret_cast<page_type*>(chunk_next);
+        chunk_next += sizeof(page_type);
+        chunk_left--;
+        allocated_pages++;
+        return page;
+    }
+
+    mutable page_cache tlb;
+    std::vector<accessor*> accessors;                  // their caches are reset by clear()
+    table_type** dir{nullptr};
+    std::vector<uint64_t> used_tables;                 // directory slots holding a table
+    std::vector<std::pair<void*, size_t>> mappings;    // page chunks and adopted mappings to unmap
+    uint8_t* chunk_next{nullptr};
+    size_t chunk_left{0};
+    uint64_t allocated_pages{0};
 };
 } // namespace util
 /** @}*/
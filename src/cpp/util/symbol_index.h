@@ -0,0 +1,188 @@
+// Copyright 2025 SiFive
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef _SYMBOL_INDEX_H_
+#define _SYMBOL_INDEX_H_
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace util {
+
+/**
+ * @brief address ranges of the symbols of a program, for "which function contains this pc"
+ *
+ * Symbols are collected with add() and indexed by build(). A symbol with a size covers
+ * [addr, addr + size). One without a size (assembler labels) covers up to the next symbol, but not
+ * past limit, usually the end of its section; such a label inside a sized symbol is dropped, the
+ * enclosing symbol is the better answer. Symbols may nest, find() returns the innermost one.
+ *
+ * The start addresses are kept in their own array, so a lookup is a binary search over densely
+ * packed addresses plus a walk up the enclosing symbols, which only happens for addresses in a gap
+ * of a nested symbol.
+ */
+class symbol_index {
+public:
+    enum class kind : uint8_t { other, object, function };
+
+    struct symbol {
+        uint64_t addr;
+        uint64_t end;    // one past the last byte
+        const char* name;
+        uint32_t parent; // index of the innermost symbol containing this one, npos if none
+        kind type;
+        bool global;
+    };
+
+    static constexpr uint32_t npos = UINT32_MAX;
+
+    /**
+     * add a symbol, it is found only after the next build()
+     *
+     * @param global  global or weak binding, preferred over a local alias with the same range
+     * @param limit   end of a symbol without size, 0 if unknown
+     */
+    void add(const std::string& name, uint64_t addr, uint64_t size, kind type, bool global, uint64_t limit = 0) {
+        raw.push_back({addr, size, limit, names.size(), type, global});
+        names.insert(names.end(), name.begin(), name.end());
+        names.push_back('\0');
+    }
+
+    // (re)build the index from all added symbols, invalidates symbol pointers handed out before
+    void build() {
+        std::vector<const raw_symbol*> sized, labels;
+        for (auto& r : raw) {
+            (r.size ? sized : labels).push_back(&r);
+        }
+        std::sort(sized.begin(), sized.end(), [](auto a, auto b) { return a->addr < b->addr; });
+        // running maximum of the ends, tells whether an address lies inside any sized symbol
+        std::vector<uint64_t> sized_starts, covered;
+        for (auto r : sized) {
+            sized_starts.push_back(r->addr);
+            covered.push_back(std::max(covered.empty() ? 0 : covered.back(), r->addr + r->size));
+        }
+        std::vector<uint64_t> all_starts = sized_starts;
+        std::vector<const raw_symbol*> kept_labels;
+        for (auto r : labels) {
+            auto it = std::upper_bound(sized_starts.begin(), sized_starts.end(), r->addr);
+            if (it == sized_starts.begin() || covered[it - sized_starts.begin() - 1] <= r->addr) {
+                kept_labels.push_back(r);
+                all_starts.push_back(r->addr);
+            }
+        }
+        std::sort(all_starts.begin(), all_starts.end());
+
+        symbols.clear();
+        for (auto r : sized) {
+            symbols.push_back({r->addr, r->addr + r->size, names.data() + r->name, npos, r->type, r->global});
+        }
+        for (auto r : kept_labels) {
+            auto next = std::upper_bound(all_starts.begin(), all_starts.end(), r->addr);
+            uint64_t end = r->limit ? r->limit : r->addr + 1;
+            if (next != all_starts.end()) {
+                end = std::min(end, *next);
+            }
+            if (end > r->addr) { // end markers like _etext cover nothing
+                symbols.push_back({r->addr, end, names.data() + r->name, npos, r->type, r->global});
+            }
+        }
+
+        // outer symbols first, of aliases covering the same range the best named one
+        auto rank = [](const symbol& s) { return int(s.type) * 2 + s.global; };
+        std::sort(symbols.begin(), symbols.end(), [&](const symbol& a, const symbol& b) {
+            if (a.addr != b.addr) {
+                return a.addr < b.addr;
+            }
+            if (a.end != b.end) {
+                return a.end > b.end;
+            }
+            return rank(a) > rank(b);
+        });
+        symbols.erase(std::unique(symbols.begin(), symbols.end(),
+                                  [](const symbol& a, const symbol& b) { return a.addr == b.addr && a.end == b.end; }),
+                      symbols.end());
+
+        // the symbols still open at each start form the chain of enclosing symbols
+        std::vector<uint32_t> open;
+        starts.clear();
+        for (uint32_t i = 0; i < symbols.size(); i++) {
+            while (!open.empty() && symbols[open.back()].end <= symbols[i].addr) {
+                open.pop_back();
+            }
+            symbols[i].parent = open.empty() ? npos : open.back();
+            open.push_back(i);
+            starts.push_back(symbols[i].addr);
+        }
+    }
+
+    /**
+     * innermost symbol containing addr
+     *
+     * @return nullptr if no symbol contains addr
+     */
+    const symbol* find(uint64_t addr) const {
+        auto it = std::upper_bound(starts.begin(), starts.end(), addr);
+        uint32_t i = it == starts.begin() ? npos : uint32_t(it - starts.begin() - 1);
+        while (i != npos) {
+            if (addr < symbols[i].end) {
+                return &symbols[i];
+            }
+            i = symbols[i].parent;
+        }
+        return nullptr;
+    }
+
+    // outermost symbol starting exactly at addr, nullptr if there is none
+    const symbol* at(uint64_t addr) const {
+        auto it = std::lower_bound(starts.begin(), starts.end(), addr);
+        if (it == starts.end() || *it != addr) {
+            return nullptr;
+        }
+        return &symbols[it - starts.begin()];
+    }
+
+    // indexed symbols ordered by address
+    const std::vector<symbol>& all() const { return symbols; }
+
+    size_t size() const { return symbols.size(); }
+    bool empty() const { return symbols.empty(); }
+
+    void clear() {
+        raw.clear();
+        names.clear();
+        symbols.clear();
+        starts.clear();
+    }
+
+private:
+    struct raw_symbol {
+        uint64_t addr;
+        uint64_t size;
+        uint64_t limit;
+        size_t name; // offset into names
+        kind type;
+        bool global;
+    };
+
+    std::vector<raw_symbol> raw;
+    std::vector<char> names;
+    std::vector<symbol> symbols;
+    std::vector<uint64_t> starts;
+};
+
+} // namespace util
+
+#endif /* _SYMBOL_INDEX_H_ */
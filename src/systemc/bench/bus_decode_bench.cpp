@@ -0,0 +1,113 @@
+// Copyright 2025 SiFive
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Microbenchmark of sc_bus_device's address decoder, build with `make bus_decode_bench`.
+// Buses with 4 to 128 devices are looked up in runs of 8 accesses to the same device, like a hart
+// polling a register block, and compared with the linear scan over get_devices() the decoder
+// replaced. decode() is the lookup without the last-hit cache, as used for DMI requests.
+
+#include <systemc>
+using namespace sc_core;
+using namespace std;
+
+#include "uncore/sc_devices.h"
+
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+static const uint64_t DEVICE_BASE = 0x10000000;
+static const uint64_t DEVICE_STRIDE = 0x10000;
+static const uint64_t DEVICE_SIZE = 0x1000;
+
+// runs of 8 accesses within one device, the devices are visited in a pseudo-random order
+static std::vector<uint64_t> make_addresses(size_t n, unsigned devices) {
+    std::vector<uint64_t> addrs(n);
+    uint64_t rng = 0x9e3779b97f4a7c15ull;
+    uint64_t dev = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (i % 8 == 0) {
+            rng ^= rng << 13;
+            rng ^= rng >> 7;
+            rng ^= rng << 17;
+            dev = rng % devices;
+        }
+        addrs[i] = DEVICE_BASE + dev * DEVICE_STRIDE + (i % 8) * 8;
+    }
+    return addrs;
+}
+
+// best time per lookup over repeat runs of f over all addresses
+template <typename F> static double measure(const std::vector<uint64_t>& addrs, unsigned repeat, F f) {
+    double best = 0;
+    for (unsigned r = 0; r < repeat; r++) {
+        const auto start = std::chrono::steady_clock::now();
+        for (uint64_t addr : addrs) {
+            f(addr);
+        }
+        const double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+        best = r == 0 ? ns : std::min(best, ns);
+    }
+    return best / addrs.size();
+}
+
+int sc_main(int argc, char* argv[]) {
+    size_t lookups = 1 << 20;
+    unsigned repeat = 5;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg.find("--lookups=") == 0) {
+            lookups = std::stoull(arg.substr(arg.find("=") + 1));
+        } else if (arg.find("--repeat=") == 0) {
+            repeat = std::max(1, std::stoi(arg.substr(arg.find("=") + 1)));
+        } else {
+            std::cerr << "usage: " << argv[0] << " [--lookups=<n>] [--repeat=<n>]" << std::endl;
+            return 1;
+        }
+    }
+
+    printf("%8s %10s %10s %10s\n", "devices", "linear", "find", "decode");
+    uintptr_t sink = 0;
+    std::vector<std::unique_ptr<sc_bus_device>> buses; // their counters stay in the stats registry
+    for (unsigned devices : {4u, 32u, 128u}) {
+        buses.push_back(std::make_unique<sc_bus_device>(("bus_" + std::to_string(devices)).c_str()));
+        sc_bus_device& bus = *buses.back();
+        for (unsigned d = 0; d < devices; d++) {
+            const std::string name = "bus_" + std::to_string(devices) + "_dev_" + std::to_string(d);
+            bus.register_device(new sc_mem_device(name.c_str(), DEVICE_BASE + d * DEVICE_STRIDE, DEVICE_SIZE));
+        }
+        const auto addrs = make_addresses(lookups, devices);
+
+        const double linear = measure(addrs, repeat, [&](uint64_t addr) {
+            for (auto& dev : bus.get_devices()) {
+                if (addr - dev.first.first < dev.first.second) {
+                    sink += reinterpret_cast<uintptr_t>(dev.second);
+                    break;
+                }
+            }
+        });
+        const double find = measure(addrs, repeat, [&](uint64_t addr) {
+            sink += reinterpret_cast<uintptr_t>(bus.find_device(addr));
+        });
+        const double decode = measure(addrs, repeat, [&](uint64_t addr) {
+            sink += reinterpret_cast<uintptr_t>(bus.decode(addr).dev);
+        });
+        printf("%8u %7.2f ns %7.2f ns %7.2f ns\n", devices, linear, find, decode);
+    }
+    printf("%zu lookups, best of %u\n", lookups, repeat);
+    return sink == 0xdeadbeef; // keeps the lookups
+}
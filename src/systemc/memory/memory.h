@@ -5,6 +5,10 @@
 #include "util/sparse_array.h"
 #include "util/dbg_component.h"
 #include "util/mem-loader.h"
+#include "util/mmio_regions.h"
+#include "util/stats.h"
+#include "util/checkpoint.h"
+#include "util/host_prof.h"
 #include <tlm_utils/simple_target_socket.h>
 #include <memory>
 #include <iomanip>
@@ -61,6 +65,10 @@ struct CircularBuffer {
     inline bool empty() const {
         return tail == head;
     }
+
+    inline size_t size() const {
+        return (head - tail) & BUFFER_MASK;
+    }
 };
 
 template <unsigned int N, typename TYPES=tlm::tlm_base_protocol_types>
@@ -78,7 +86,7 @@ public:
 
     mem_module(
         sc_module_name nm,
-        util::sparse_array<uint8_t, 18, 30>* m_ptr,
+        util::sparse_array<uint8_t, 36, 12>* m_ptr,
         unsigned r_done,
         unsigned r_ack,
         unsigned w_done,
@@ -93,6 +101,9 @@ public:
     , debug_component("mem_module")
     {
         socket.register_nb_transport_fw(this, &mem_module::transport_fw);
+        socket.register_get_direct_mem_ptr(this, &mem_module::get_direct_mem_ptr);
+        socket.register_b_transport(this, &mem_module::b_transport);
+        socket.register_transport_dbg(this, &mem_module::transport_dbg);
 
         SC_METHOD(do_read);
         sensitive << pend_r_q_ev;
@@ -115,8 +126,48 @@ public:
         dont_initialize();
     
         printVerb = false; // (program_options::getInstance().getVerbosity() >= 1) ? true : false;
+
+        mmio.add_region("finisher", SOC_SCR_FINISH, 4, [this](uint64_t, const uint8_t* data_ptr, size_t) {
+          const unsigned int testStatus = ((unsigned int*)data_ptr)[0];
+          if (testStatus != 0 && !testStatusWritten) {
+            if (testStatus == 0x5555) {
+                cout << "PASS" << endl;
+            } else {
+                cout << "FAIL" << endl;
+            }
+            testStatusWritten = true;
+            // don't finish immediately, allow 100 cycles to be dumped to VCD file
+            stop_event.notify(SC_ZERO_TIME);
+          }
+          return false;
+        });
+        mmio.add_region("print", SOC_SCR_PRINT, 4, [this](uint64_t, const uint8_t* data_ptr, size_t) {
+          if (printVerb) {
+            printf("%c", (int)data_ptr[0]);
+          }
+          return false;
+        });
+
+        auto& reg = util::stats_registry::instance();
+        const std::string prefix = std::string(name()) + ".";
+        reg.add(prefix + "reads", &stats.reads);
+        reg.add(prefix + "writes", &stats.writes);
+        reg.add(prefix + "bytes_read", &stats.bytes_read);
+        reg.add(prefix + "bytes_written", &stats.bytes_written);
+        reg.add(prefix + "read_queue_max", &stats.read_queue_max);
+        reg.add(prefix + "write_queue_max", &stats.write_queue_max);
+        reg.add(prefix + "read_queue_avg", [this]() {
+          return stats.reads ? double(stats.read_queue_sum) / stats.reads : 0.0;
+        });
+        reg.add(prefix + "write_queue_avg", [this]() {
+          return stats.writes ? double(stats.write_queue_sum) / stats.writes : 0.0;
+        });
+        reg.add(prefix + "resident_bytes", [this]() { return double(mem_ptr->resident_bytes()); });
     }
 
+    // device registers handled inside the memory, register more to add devices
+    util::mmio_region_table& mmio_regions() { return mmio; }
+
     // helper to calculate next rising clock edge
     inline sc_time getNextRisingClockEdge(unsigned clk_cycles) {
         return clk_cycles * clock_period + (sc_core::sc_time_stamp() % clock_period);
@@ -131,23 +182,17 @@ public:
     tlm::tlm_sync_enum transport_fw(tlm::tlm_generic_payload& trans, tlm::tlm_phase& phase, sc_core::sc_time& t) {
         tlm::tlm_command cmd = trans.get_command();
 
-        if (isDebugEnabled()) {
-          std::stringstream ss;
-          ss << "{\"t\":"<< sc_core::sc_time_stamp().to_double() << "," << "\"addr\":\"0x"<<hex<<trans.get_address()<<"\", \"msg\":\"";
-          if (cmd == tlm::TLM_READ_COMMAND) {
-            ss << "TLM_MEM_READ";
-          } else {
-            ss << "TLM_MEM_WRITE";
-          }
-          ss << " phase " << phase << "\"}";
-          log_debug(ss.str());
-        }
+        TRACE_MEM_REQUEST(sc_core::sc_time_stamp().to_double(), trans.get_address(),
+                          cmd == tlm::TLM_READ_COMMAND, (uint32_t)phase);
         switch(cmd) {
         case(tlm::TLM_READ_COMMAND): {
             switch(phase) {
             case(tlm::BEGIN_REQ): {
                 pend_r_q_ev.notify(getNextRisingClockEdge(read_done_delay));
+                if (trans.has_mm()) trans.acquire(); // held until the response is sent
                 pend_r_q.push_back(&trans);
+                stats.read_queue_max = std::max<uint64_t>(stats.read_queue_max, pend_r_q.size());
+                stats.read_queue_sum += pend_r_q.size();
 
                 phase = tlm::END_REQ;
                 sc_time t{SC_ZERO_TIME};
@@ -165,7 +210,10 @@ public:
             switch(phase) {
             case tlm::BEGIN_REQ: {
                 pend_w_q_ev.notify(getNextRisingClockEdge(write_done_delay));
+                if (trans.has_mm()) trans.acquire(); // held until the response is sent
                 pend_w_q.push_back(&trans);
+                stats.write_queue_max = std::max<uint64_t>(stats.write_queue_max, pend_w_q.size());
+                stats.write_queue_sum += pend_w_q.size();
 
                 phase = tlm::END_REQ;
                 sc_time t{SC_ZERO_TIME};
@@ -185,30 +233,85 @@ public:
         return tlm::TLM_COMPLETED;
     }
 
+    // DMI is granted one page at a time, pages holding device registers are denied
+    bool get_direct_mem_ptr(tlm::tlm_generic_payload& trans, tlm::tlm_dmi& dmi_data) {
+      const uint64_t page = trans.get_address() & ~(util::mmio_region_table::page_size - 1);
+      dmi_data.set_start_address(page);
+      dmi_data.set_end_address(page + util::mmio_region_table::page_size - 1);
+      if (mmio.is_mmio_page(page)) {
+        dmi_data.allow_none();
+        return false;
+      }
+      dmi_data.set_dmi_ptr((unsigned char*)mem_ptr->get_ptr(page));
+      dmi_data.allow_read_write();
+      dmi_data.set_read_latency((read_done_delay + read_ack_delay) * clock_period);
+      dmi_data.set_write_latency((write_done_delay + write_ack_delay) * clock_period);
+      return true;
+    }
+
+    // untimed access for debuggers and profilers: no statistics, no traces, device registers excluded
+    unsigned int transport_dbg(tlm::tlm_generic_payload& trans) {
+      const auto addr = trans.get_address();
+      const unsigned len = trans.get_data_length();
+      if (len == 0 || trans.get_command() == tlm::TLM_IGNORE_COMMAND || addr + len - 1 < addr) {
+        return 0;
+      }
+      // a device page anywhere in the range, not only at its ends
+      const uint64_t page_size = util::mmio_region_table::page_size;
+      for (uint64_t page = addr / page_size; page <= (addr + len - 1) / page_size; page++) {
+        if (mmio.is_mmio_page(page * page_size)) {
+          return 0;
+        }
+      }
+      if (trans.is_read()) {
+        mem_ptr->read(addr, trans.get_data_ptr(), len);
+      } else {
+        mem_ptr->write(addr, trans.get_data_ptr(), len);
+      }
+      return len;
+    }
+
+    // must be called whenever pages handed out through DMI go away, e.g. after mem_ptr->clear()
+    void invalidate_dmi() {
+      socket->invalidate_direct_mem_ptr(0, ~sc_dt::uint64(0));
+    }
+
+    // loosely-timed access, the whole request/response latency is annotated to t
+    void b_transport(tlm::tlm_generic_payload& trans, sc_core::sc_time& t) {
+      if (trans.is_read()) {
+        read_trans(trans);
+        t += (read_done_delay + read_ack_delay) * clock_period;
+      } else {
+        write_trans(trans);
+        t += (write_done_delay + write_ack_delay) * clock_period;
+      }
+      trans.set_response_status(tlm::TLM_OK_RESPONSE);
+    }
+
+    void read_trans(tlm::tlm_generic_payload& trans) {
+        const auto addr = trans.get_address();
+        uint8_t* const data_ptr = trans.get_data_ptr();
+        const unsigned data_len = trans.get_data_length();
+        stats.reads++;
+        stats.bytes_read += data_len;
+        // do read
+        if (!(mmio.is_mmio_page(addr) && mmio.read(addr, data_ptr, data_len))) {
+          mem_ptr->read(addr, data_ptr, data_len);
+        }
+
+        TRACE_MEM_DONE(sc_core::sc_time_stamp().to_double(), addr, true, data_ptr, data_len);
+    }
+
     void do_read(){
+      HOST_PROF_SCOPE("mem_module::do_read");
       if (!pend_r_q.empty()) {
         auto* trans = pend_r_q.pop_front();
         
         assert(trans != nullptr);
-        const auto addr = trans->get_address();
-        uint8_t* const data_ptr = trans->get_data_ptr();
-        const unsigned data_len = trans->get_data_length();
-        // do read
-        mem_ptr->read(addr, data_ptr, data_len);
+        read_trans(*trans);
         // schedule notification
         ack_r_q.push_back(trans);
         ack_r_q_ev.notify(getNextRisingClockEdge(read_ack_delay));
-
-        if(isDebugEnabled()) {
-          std::stringstream ss;
-          ss << "{\"t\":"<< sc_core::sc_time_stamp().to_double() << "," << "\"addr\":\"0x"<<hex<<addr<<"\","<<"\"data\":\"0x";
-          ss << std::hex;
-          for(int i = 0; i < data_len; i++ ) {
-            ss << std::setw(2) << std::setfill('0') << (int)data_ptr[i];
-          }
-          ss << "\",\"msg\":\"TLM_MEM_READ done\"}";
-          log_debug(ss.str());
-        }
       }
       else {
         cerr << "pend_r_q is empty @" << sc_core::sc_time_stamp() << endl;
@@ -220,50 +323,30 @@ public:
 
     static bool testStatusWritten;
 
+    void write_trans(tlm::tlm_generic_payload& trans) {
+        const auto addr = trans.get_address();
+        uint8_t* const data_ptr = trans.get_data_ptr();
+        const unsigned data_len = trans.get_data_length();
+        uint8_t* const be_ptr = trans.get_byte_enable_ptr();
+        const unsigned be_len = trans.get_byte_enable_length();
+        stats.writes++;
+        stats.bytes_written += data_len;
+
+        // do write
+        if (!(mmio.is_mmio_page(addr) && mmio.write(addr, data_ptr, data_len))) {
+          mem_ptr->write(addr, data_ptr, data_len, be_ptr, be_len);
+        }
+
+        // TODO: replace to_double()
+        TRACE_MEM_DONE(sc_core::sc_time_stamp().to_double(), addr, false, data_ptr, data_len);
+    }
+
     void do_write(){
+      HOST_PROF_SCOPE("mem_module::do_write");
       if (!pend_w_q.empty()) {
         auto* trans = pend_w_q.pop_front();
         assert(trans != nullptr);
-
-        const auto addr = trans->get_address();
-        uint8_t* const data_ptr = trans->get_data_ptr();
-        const unsigned data_len = trans->get_data_length();
-        uint8_t* const be_ptr = trans->get_byte_enable_ptr();
-        const unsigned be_len = trans->get_byte_enable_length();
-
-
-
-        if (addr == SOC_SCR_FINISH) {
-          const unsigned int testStatus = ((unsigned int*)data_ptr)[0];
-          if (testStatus != 0 && !testStatusWritten) {
-            if (testStatus == 0x5555) {
-                cout << "PASS" << endl;
-            } else {
-                cout << "FAIL" << endl;
-            }
-            testStatusWritten = true;
-            // don't finish immediately, allow 100 cycles to be dumped to VCD file
-            stop_event.notify(SC_ZERO_TIME);
-          }
-        } else
-          if (printVerb && addr == SOC_SCR_PRINT) {
-            printf("%c", (int)data_ptr[0]);
-        }
-
-        // do write
-        mem_ptr->write(addr, data_ptr, data_len, be_ptr, be_len);
-
-        if (isDebugEnabled()){
-          // TODO: replace to_double()
-          std::stringstream ss;
-          ss << "{\"t\":"<< sc_core::sc_time_stamp().to_double() << "," << "\"addr\":\"0x"<<hex<<addr<<"\","<<"\"data\":\"0x";
-          ss << std::hex;
-          for(int i = 0; i < data_len; i++ ) {
-            ss << std::setw(2) << std::setfill('0') << (int)data_ptr[i];
-          }
-          ss << "\",\"msg\":\"TLM_MEM_WRITE done\"}";
-          log_debug(ss.str());
-        }
+        write_trans(*trans);
 
         // schedule notification
         ack_w_q.push_back(trans);
@@ -284,6 +367,7 @@ public:
         trans->set_response_status(tlm::TLM_OK_RESPONSE);
 
         auto begin_resp_reply = socket->nb_transport_bw(*trans, phase, t);
+        if (trans->has_mm()) trans->release();
       }
       else {
         cerr << "ack_r_q is empty @ " << sc_core::sc_time_stamp() << endl;
@@ -299,6 +383,7 @@ public:
         trans->set_response_status(tlm::TLM_OK_RESPONSE);
 
          auto begin_resp_reply = socket->nb_transport_bw(*trans, phase, t);
+         if (trans->has_mm()) trans->release();
       } else {
         cerr << "ack_w_q is empty @ " << sc_core::sc_time_stamp() << endl;
       }
@@ -327,7 +412,18 @@ public:
     sc_event_queue SC_NAMED(pend_w_q_ev);
     sc_event_queue SC_NAMED(ack_w_q_ev);
 
-    util::sparse_array<uint8_t, 18, 30>* mem_ptr; // pointer to memory array
+    util::sparse_array<uint8_t, 36, 12>* mem_ptr; // pointer to memory array
+    util::mmio_region_table mmio;
+    struct {
+      uint64_t reads{0};
+      uint64_t writes{0};
+      uint64_t bytes_read{0};
+      uint64_t bytes_written{0};
+      uint64_t read_queue_max{0};
+      uint64_t write_queue_max{0};
+      uint64_t read_queue_sum{0};  // occupancy seen by each request, including itself
+      uint64_t write_queue_sum{0};
+    } stats;
     sc_time clock_period{0, SC_NS};               // to be filled in end_of_elaboration
 
 }; // end class mem_module
@@ -347,12 +443,41 @@ public:
     mem_module_0.enableDebug();
   }
 
+  uint64_t resident_bytes() const { return mem0.resident_bytes(); }
+
+  // memory contents as section "mem" of a checkpoint, restored pages are mapped from the file.
+  // A delta ("memdelta") only holds the pages written since the previous save_state or
+  // restore_state and is restored on top of that state
+  void save_state(util::checkpoint_writer& ckpt, bool delta = false) {
+    if (delta) {
+      ckpt.add_memory_delta("memdelta", mem0);
+    } else {
+      ckpt.add_memory("mem", mem0);
+    }
+    mem0.clear_dirty();
+    // writes through DMI pointers are not tracked, initiators have to ask for them again
+    if (sc_core::sc_is_running()) {
+      mem_module_0.invalidate_dmi();
+    }
+  }
+  void restore_state(const util::checkpoint_reader& ckpt) {
+    if (ckpt.has("memdelta")) {
+      ckpt.apply_memory_delta("memdelta", mem0);
+    } else {
+      ckpt.restore_memory("mem", mem0);
+    }
+    mem0.clear_dirty();
+    if (sc_core::sc_is_running()) {
+      mem_module_0.invalidate_dmi();
+    }
+  }
+
 
 private:
 
   mem_module<256> SC_NAMED(mem_module_0, &mem0, 1, 6, 0, 5);
 
-  util::sparse_array<uint8_t, 18, 30> mem0;
+  util::sparse_array<uint8_t, 36, 12> mem0;
 
 public:
   mir_tlm_bare(sc_module_name nm)
@@ -0,0 +1,184 @@
+// Copyright 2025 SiFive
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Replays a memory trace recorded with `demo --trace=<file>` into the memory system without
+// running the ISS. Requests are issued with b_transport at their recorded time, either straight
+// into mir_tlm_bare or through an sc_cache_device in front of it. Writes are only replayed when
+// the trace holds their data.
+
+#include <systemc>
+using namespace sc_core;
+using namespace std;
+#include <tlm.h>
+#include <tlm_utils/simple_initiator_socket.h>
+
+#include "memory/memory.h"
+#include "uncore/sc_devices.h"
+#include "util/mem_trace.h"
+#include "util/stats.h"
+
+#include <chrono>
+
+class trace_replayer : public sc_module {
+public:
+    SC_HAS_PROCESS(trace_replayer);
+
+    using socket_t = tlm_utils::simple_initiator_socket<trace_replayer, 256>;
+    // only exists when there is no cache, the cache has its own socket to memory
+    std::unique_ptr<socket_t> init_socket;
+
+    trace_replayer(sc_module_name nm, const std::string& file, sc_cache_device* cache)
+    : sc_module(nm)
+    , reader(file)
+    , cache(cache) {
+        if (!cache) {
+            init_socket = std::make_unique<socket_t>("init_socket");
+        }
+        SC_THREAD(run);
+    }
+
+    uint64_t transactions{0};
+
+private:
+    // requests are issued at their recorded time, or when the previous one completed if that is
+    // later. The replayer runs ahead of the kernel, local is its time relative to sc_time_stamp()
+    void run() {
+        util::mem_trace_record rec;
+        std::vector<uint8_t> bytes;
+        sc_time local{SC_ZERO_TIME};
+        sc_time latency{SC_ZERO_TIME};
+        uint64_t skipped = 0;
+        const auto start = std::chrono::steady_clock::now();
+
+        if (!reader.has_data()) {
+            cout << "Trace has no write data (record it with --trace-data), writes are skipped" << endl;
+        }
+        while (reader.next(rec, bytes)) {
+            if (rec.is_write && bytes.size() < rec.size) {
+                // writing anything else than the recorded data would change what later reads see
+                skipped++;
+                continue;
+            }
+            bytes.resize(rec.size);
+            const sc_time when(double(rec.time_ps), SC_PS);
+            if (when > sc_time_stamp() + local) {
+                local = when - sc_time_stamp();
+            }
+            const sc_time issued = local;
+            if (cache) {
+                if (rec.is_write) {
+                    cache->write(rec.addr, bytes.data(), rec.size);
+                } else {
+                    cache->read(rec.addr, bytes.data(), rec.size);
+                }
+                local += cache->access_latency();
+            } else {
+                tlm::tlm_generic_payload trans;
+                trans.set_command(rec.is_write ? tlm::TLM_WRITE_COMMAND : tlm::TLM_READ_COMMAND);
+                trans.set_address(rec.addr);
+                trans.set_data_ptr(bytes.data());
+                trans.set_data_length(rec.size);
+                trans.set_streaming_width(rec.size);
+                (*init_socket)->b_transport(trans, local);
+            }
+            latency += local - issued;
+            transactions++;
+        }
+
+        const double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        cout << "Replayed " << transactions << " transactions in " << wall << " s ("
+             << (wall > 0 ? transactions / wall / 1e6 : 0.0) << " M/s), memory latency " << latency
+             << ", last response @ " << sc_time_stamp() + local << endl;
+        if (skipped) {
+            cout << "Skipped " << skipped << " writes without data" << endl;
+        }
+        if (cache) {
+            cache->print_stats(cout);
+        }
+        sc_stop();
+    }
+
+    util::mem_trace_reader reader;
+    sc_cache_device* cache;
+};
+
+int sc_main(int argc, char* argv[]) {
+    std::string trace_file;
+    std::string stats_file;
+    bool use_cache = false;
+    cache_config cache_cfg;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--cache") {
+            use_cache = true;
+        } else if (arg.find("--cache-size=") == 0) {
+            use_cache = true;
+            cache_cfg.size = std::stoull(arg.substr(arg.find("=") + 1));
+        } else if (arg.find("--cache-ways=") == 0) {
+            use_cache = true;
+            cache_cfg.ways = std::stoul(arg.substr(arg.find("=") + 1));
+        } else if (arg.find("--cache-line=") == 0) {
+            use_cache = true;
+            cache_cfg.line_size = std::stoul(arg.substr(arg.find("=") + 1));
+        } else if (arg.find("--cache-policy=") == 0) {
+            use_cache = true;
+            const std::string policy = arg.substr(arg.find("=") + 1);
+            cache_cfg.policy = policy == "plru"   ? cache_config::replacement::plru
+                             : policy == "random" ? cache_config::replacement::random
+                                                  : cache_config::replacement::lru;
+        } else if (arg == "--write-through") {
+            use_cache = true;
+            cache_cfg.write_back = false;
+        } else if (arg == "--no-write-allocate") {
+            use_cache = true;
+            cache_cfg.write_allocate = false;
+        } else if (arg.find("--stats=") == 0) {
+            stats_file = arg.substr(arg.find("=") + 1);
+        } else if (arg.find("--") != 0) {
+            trace_file = arg;
+        }
+    }
+    if (trace_file.empty()) {
+        std::cerr << "usage: " << argv[0] << " [--cache] [--cache-size=<bytes>] [--cache-ways=<n>] "
+                  << "[--cache-line=<bytes>] [--cache-policy=lru|plru|random] [--write-through] "
+                  << "[--no-write-allocate] [--stats=<file>] <trace>" << std::endl;
+        return 1;
+    }
+
+    sc_clock SC_NAMED(clk, 10, SC_NS);
+    mir_tlm_bare SC_NAMED(mem);
+    mem.clock(clk);
+
+    std::unique_ptr<sc_cache_device> cache;
+    if (use_cache) {
+        cache = std::make_unique<sc_cache_device>("cache", 0, ~uint64_t(0), cache_cfg);
+        cache->mem_socket.bind(mem.target_socket);
+    }
+    trace_replayer SC_NAMED(replayer, trace_file, cache.get());
+    if (!use_cache) {
+        replayer.init_socket->bind(mem.target_socket);
+    }
+
+    std::unique_ptr<util::stats_reporter> stats;
+    if (!stats_file.empty()) {
+        stats = std::make_unique<util::stats_reporter>("stats", stats_file);
+    }
+
+    sc_start();
+    if (stats) {
+        stats->dump_final();
+    }
+    return 0;
+}
@@ -1,8 +1,10 @@
 #include "turbo/turbo_core.h"
 #include "uncore/turbo_uncore.h"
 #include "memory/memory.h"
+#include "util/host_prof.h"
 #include "riscv/remote_bitbang.h"
 #include "riscv/jtag_dtm.h"
+#include <fstream>
 
 
 #define START_PC 0x20000000
@@ -13,7 +15,8 @@ public:
 
     sc_in<bool> SC_NAMED(clk_i);
 
-    testbench(sc_module_name nm, const cfg_t &cfg, const debug_module_config_t &dm_config, bool enable_debug)
+    testbench(sc_module_name nm, const cfg_t &cfg, const debug_module_config_t &dm_config, bool enable_debug,
+              const std::string& elf_file, bool map_elf)
     : sc_module(nm) {
         SC_THREAD(run);
 
@@ -27,10 +30,6 @@ public:
         core->init_socket(uncore->targ_socket);
         uncore->init_socket(mem->target_socket);
         
-        //auto start_pc = mem->mem_loader.loadElf("rot13-64");
-        auto start_pc = mem->mem_loader.loadElf("sw/main.elf");
-        cout << "Start pc = " << start_pc << endl;
-
         if (enable_debug) {
             core->enableDebug(true);
             mem->enableDebug();
@@ -38,25 +37,51 @@ public:
             core->configure_log(true, false);
         }
 
-        // load "ROM"
-        uint64_t reset_vect_0 = start_pc;
-        uint8_t reset_vec_size = 8;
-        std::vector<uint32_t> reset_vec_data;
-        reset_vec_data.reserve(reset_vec_size);
-        reset_vec_data.push_back(0x297);                                // auipc  t0,0x0
-        reset_vec_data.push_back(0x28593 + (reset_vec_size * 4 << 20)); // addi   a1, t0, &dtb
-        reset_vec_data.push_back(0xf1402573);                           // csrr   a0, mhartid
-        reset_vec_data.push_back(0x0182b283); // lw/ld  t0,24(t0)
-        reset_vec_data.push_back(0x28067);
-        reset_vec_data.push_back(0);
-        reset_vec_data.push_back(reset_vect_0 & 0xffffffff);
-        reset_vec_data.push_back(reset_vect_0 >> 32);
-        uint64_t start_addr = 0x1000;
-        mem->mem_loader.loadVector(reset_vec_data, start_addr);
+        // an empty elf_file leaves the memory to restore_checkpoint
+        if (!elf_file.empty()) {
+            //auto start_pc = mem->mem_loader.loadElf("rot13-64");
+            auto start_pc = mem->mem_loader.loadElf(elf_file, map_elf, &core->symbol_table());
+            cout << "Start pc = " << start_pc << endl;
+
+            // load "ROM"
+            uint64_t reset_vect_0 = start_pc;
+            uint8_t reset_vec_size = 8;
+            std::vector<uint32_t> reset_vec_data;
+            reset_vec_data.reserve(reset_vec_size);
+            reset_vec_data.push_back(0x297);                                // auipc  t0,0x0
+            reset_vec_data.push_back(0x28593 + (reset_vec_size * 4 << 20)); // addi   a1, t0, &dtb
+            reset_vec_data.push_back(0xf1402573);                           // csrr   a0, mhartid
+            reset_vec_data.push_back(0x0182b283); // lw/ld  t0,24(t0)
+            reset_vec_data.push_back(0x28067);
+            reset_vec_data.push_back(0);
+            reset_vec_data.push_back(reset_vect_0 & 0xffffffff);
+            reset_vec_data.push_back(reset_vect_0 >> 32);
+            // there is no device tree, the word a1 points to holds the number of harts instead
+            reset_vec_data.push_back(cfg.nprocs());
+            uint64_t start_addr = 0x1000;
+            mem->mem_loader.loadVector(reset_vec_data, start_addr);
+        }
     }
 
     ~testbench() = default;
 
+    void save_checkpoint(const std::string& file, bool delta = false) {
+        util::checkpoint_writer ckpt(file);
+        core->save_state(ckpt);
+        uncore->flush_cache(); // dirty lines are part of the memory contents
+        mem->save_state(ckpt, delta);
+        ckpt.close();
+        cout << "Checkpoint saved after " << dec << core->instret() << " instructions" << endl;
+    }
+
+    // takes the place of the ELF, call before sc_start. Deltas go on top of the checkpoint
+    // they follow
+    void restore_checkpoint(const std::string& file) {
+        util::checkpoint_reader ckpt(file);
+        core->restore_state(ckpt);
+        mem->restore_state(ckpt);
+    }
+
     std::unique_ptr<turbo_core> core;
     std::unique_ptr<turbo_uncore> uncore;
     std::unique_ptr<mir_tlm_bare> mem;
@@ -75,6 +100,27 @@ int sc_main(int argc, char* argv[]) {
     uint16_t rbb_port = 0;
     bool use_rbb = false;
     unsigned dmi_rti = 0; // TODO: check if this should be parsed from command line
+    util::quantum_controller quantum;
+    bool use_dmi = false;
+    bool use_lt = false;
+    bool posted_stores = false;
+    bool map_elf = false;
+    size_t nharts = 1;
+    std::string elf_file = "sw/main.elf";
+    std::string stats_file;
+    double stats_interval_us = 0;
+    std::string trace_file;
+    bool trace_data = false;
+    std::string checkpoint_file;
+    uint64_t checkpoint_after = 0;
+    uint64_t checkpoint_every = 0;
+    std::vector<std::string> restore_files;
+    std::string profile_file;
+    uint64_t profile_interval = 10000;
+    bool host_prof = false;
+    std::string host_trace_file;
+    bool use_cache = false;
+    cache_config cache_cfg;
 
 
     for (int i = 1; i < argc; i++) {
@@ -89,6 +135,96 @@ int sc_main(int argc, char* argv[]) {
             } 
             std::cout << "RBB port set to " << rbb_port << std::endl;
             use_rbb = true;
+        } else if (arg.find("--quantum=") == 0) {
+            if (!quantum.parse(arg.substr(arg.find("=") + 1))) {
+                std::cerr << "Error: invalid quantum " << arg << std::endl;
+                return 1;
+            }
+            std::cout << "Quantum set to " << arg.substr(arg.find("=") + 1) << std::endl;
+        } else if (arg == "--dmi") {
+            std::cout << "DMI enabled" << std::endl;
+            use_dmi = true;
+        } else if (arg == "--lt") {
+            std::cout << "Loosely-timed mode enabled" << std::endl;
+            use_lt = true;
+        } else if (arg == "--posted-stores") {
+            std::cout << "Posted stores enabled" << std::endl;
+            posted_stores = true;
+        } else if (arg == "--map-elf") {
+            std::cout << "ELF segments mapped from the file" << std::endl;
+            map_elf = true;
+        } else if (arg.find("--harts=") == 0) {
+            nharts = std::stoul(arg.substr(arg.find("=") + 1));
+            std::cout << "Number of harts set to " << nharts << std::endl;
+        } else if (arg.find("--stats=") == 0) {
+            stats_file = arg.substr(arg.find("=") + 1);
+            std::cout << "Statistics written to " << stats_file << std::endl;
+        } else if (arg.find("--stats-interval=") == 0) {
+            stats_interval_us = std::stod(arg.substr(arg.find("=") + 1));
+            std::cout << "Statistics interval set to " << stats_interval_us << " us" << std::endl;
+        } else if (arg.find("--trace=") == 0) {
+            trace_file = arg.substr(arg.find("=") + 1);
+            std::cout << "Memory trace written to " << trace_file << std::endl;
+        } else if (arg == "--trace-data") {
+            trace_data = true;
+        } else if (arg.find("--checkpoint=") == 0) {
+            checkpoint_file = arg.substr(arg.find("=") + 1);
+            std::cout << "Checkpoint written to " << checkpoint_file << std::endl;
+        } else if (arg.find("--checkpoint-after=") == 0) {
+            checkpoint_after = std::stoull(arg.substr(arg.find("=") + 1));
+            std::cout << "Checkpoint taken after " << checkpoint_after << " instructions" << std::endl;
+        } else if (arg.find("--checkpoint-every=") == 0) {
+            checkpoint_every = std::stoull(arg.substr(arg.find("=") + 1));
+            std::cout << "Checkpoint taken every " << checkpoint_every << " instructions" << std::endl;
+        } else if (arg.find("--restore=") == 0) {
+            // repeat to apply deltas on top of the first checkpoint
+            restore_files.push_back(arg.substr(arg.find("=") + 1));
+            std::cout << "Restoring from " << restore_files.back() << std::endl;
+        } else if (arg.find("--profile=") == 0) {
+            profile_file = arg.substr(arg.find("=") + 1);
+            std::cout << "Profile written to " << profile_file << std::endl;
+        } else if (arg.find("--profile-interval=") == 0) {
+            profile_interval = std::stoull(arg.substr(arg.find("=") + 1));
+            std::cout << "Profile sampled every " << profile_interval << " instructions" << std::endl;
+        } else if (arg == "--host-prof") {
+            std::cout << "Host profiling enabled" << std::endl;
+            host_prof = true;
+        } else if (arg.find("--host-trace=") == 0) {
+            host_trace_file = arg.substr(arg.find("=") + 1);
+            std::cout << "Host trace written to " << host_trace_file << std::endl;
+            host_prof = true;
+        } else if (arg == "--cache") {
+            std::cout << "Cache in front of memory enabled" << std::endl;
+            use_cache = true;
+        } else if (arg.find("--cache-size=") == 0) {
+            use_cache = true;
+            cache_cfg.size = std::stoull(arg.substr(arg.find("=") + 1));
+            std::cout << "Cache size set to " << cache_cfg.size << " bytes" << std::endl;
+        } else if (arg.find("--cache-ways=") == 0) {
+            use_cache = true;
+            cache_cfg.ways = std::stoul(arg.substr(arg.find("=") + 1));
+            std::cout << "Cache ways set to " << cache_cfg.ways << std::endl;
+        } else if (arg.find("--cache-line=") == 0) {
+            use_cache = true;
+            cache_cfg.line_size = std::stoul(arg.substr(arg.find("=") + 1));
+            std::cout << "Cache line size set to " << cache_cfg.line_size << " bytes" << std::endl;
+        } else if (arg.find("--cache-policy=") == 0) {
+            use_cache = true;
+            const std::string policy = arg.substr(arg.find("=") + 1);
+            cache_cfg.policy = policy == "plru"   ? cache_config::replacement::plru
+                             : policy == "random" ? cache_config::replacement::random
+                                                  : cache_config::replacement::lru;
+            std::cout << "Cache replacement policy set to " << policy << std::endl;
+        } else if (arg == "--write-through") {
+            std::cout << "Write-through cache enabled" << std::endl;
+            use_cache = true;
+            cache_cfg.write_back = false;
+        } else if (arg == "--no-write-allocate") {
+            std::cout << "Cache write allocation disabled" << std::endl;
+            use_cache = true;
+            cache_cfg.write_allocate = false;
+        } else if (arg.find("--") != 0) {
+            elf_file = arg;
         }
     }
 
@@ -100,12 +236,55 @@ int sc_main(int argc, char* argv[]) {
     cfg.start_pc = START_PC;  // Start PC
     cfg.mem_layout.clear();
     cfg.pmpregions = 16;
-    cfg.hartids = {0};
+    cfg.hartids.clear();
+    for (size_t i = 0; i < nharts; i++) {
+        cfg.hartids.push_back(i);
+    }
 
     debug_module_config_t dm_config; // all default params
 
     // Create testbench
-    testbench SC_NAMED(tb, cfg, dm_config, enable_debug);
+    testbench SC_NAMED(tb, cfg, dm_config, enable_debug, restore_files.empty() ? elf_file : "", map_elf);
+    tb.core->quantum() = quantum;
+    tb.core->set_dmi(use_dmi);
+    tb.core->set_posted_stores(posted_stores);
+    if (use_cache) {
+        if (use_dmi) {
+            std::cout << "DMI is not granted for memory behind the cache" << std::endl;
+        }
+        tb.uncore->enable_cache(cache_cfg);
+    }
+    if (!trace_file.empty()) {
+        tb.uncore->start_trace(trace_file, trace_data);
+    }
+    for (const auto& file : restore_files) {
+        tb.restore_checkpoint(file);
+    }
+    if (!checkpoint_file.empty()) {
+        if (checkpoint_every) {
+            // <file>.0 is complete, <file>.1, <file>.2, ... are deltas
+            auto seq = std::make_shared<unsigned>(0);
+            tb.core->request_checkpoint(tb.core->instret() + checkpoint_every, [&tb, checkpoint_file, seq]() {
+                tb.save_checkpoint(checkpoint_file + "." + std::to_string(*seq), *seq > 0);
+                ++*seq;
+            }, checkpoint_every);
+        } else if (checkpoint_after) {
+            tb.core->request_checkpoint(tb.core->instret() + checkpoint_after, [&tb, checkpoint_file]() {
+                tb.save_checkpoint(checkpoint_file);
+            });
+        } else {
+            std::cerr << "Error: --checkpoint needs --checkpoint-after or --checkpoint-every" << std::endl;
+            return 1;
+        }
+    }
+    if (!profile_file.empty()) {
+        tb.core->enable_profiler(profile_interval);
+    }
+    if (use_lt) {
+        // the core runs ahead of the kernel by at most this much
+        tlm::tlm_global_quantum::instance().set(sc_time(1, SC_US));
+        tb.core->set_lt(true);
+    }
 
     std::unique_ptr<remote_bitbang_t> remote_bitbang((remote_bitbang_t *) NULL);
 
@@ -118,9 +297,37 @@ int sc_main(int argc, char* argv[]) {
 
     sc_clock SC_NAMED(clk, 10, SC_NS);
     tb.clk_i(clk);
+
+    std::unique_ptr<util::stats_reporter> stats;
+    if (!stats_file.empty()) {
+        stats = std::make_unique<util::stats_reporter>("stats", stats_file, sc_time(stats_interval_us, SC_US));
+    }
     
+    if (host_prof) {
+        util::host_profiler::instance().enable(!host_trace_file.empty());
+    }
+
     // Start simulation
     sc_start();
+    util::log_writer::instance().flush();
+    if (stats) {
+        stats->dump_final();
+    }
+    if (auto* cache = tb.uncore->get_cache()) {
+        cache->print_stats(cout);
+    }
+    if (auto* prof = tb.core->profiler()) {
+        // flat profile on stdout, folded stacks for flamegraph tools to the file
+        prof->write_flat(stdout, tb.core->symbol_table(), 20);
+        std::ofstream profile_out(profile_file);
+        prof->write_folded(profile_out, tb.core->symbol_table());
+    }
+    if (host_prof) {
+        util::host_profiler::instance().report(stdout);
+        if (!host_trace_file.empty()) {
+            util::host_profiler::instance().write_trace(host_trace_file);
+        }
+    }
     
     return 0;
 }
@@ -0,0 +1,66 @@
+#define SCR_BASE 0x3fffb000
+#define HART_COUNT_ADDR 0x1020 // after the reset vector, written by the testbench
+#define DATA_BASE 0x40000000 // 64 KiB of data per hart
+#define SYNC_BASE 0x4f000000 // counters shared by all harts
+
+#define WORDS_PER_HART 4096
+#define ITERATIONS 16
+
+unsigned volatile * const p_finisher = (unsigned *) (SCR_BASE + 8);
+unsigned volatile * const p_hart_count = (unsigned *) (HART_COUNT_ADDR);
+unsigned volatile * const p_harts_done = (unsigned *) (SYNC_BASE + 0x40);
+unsigned volatile * const p_harts_failed = (unsigned *) (SYNC_BASE + 0x80);
+
+static inline unsigned cpu_get_current_hartid() {
+  unsigned mhartid;
+  __asm__ volatile("csrr %0, mhartid" : "=r"(mhartid));
+  return mhartid;
+}
+
+static inline void atomic_inc(unsigned volatile * p) {
+  __asm__ volatile("amoadd.w zero, %1, (%0)" :: "r"(p), "r"(1) : "memory");
+}
+
+// fill the hart's private region and sum it back a few times, returns 0 on success
+__attribute__((noinline)) unsigned task_fill_sum(unsigned hartid) {
+  unsigned * const data = (unsigned *) (DATA_BASE + hartid * 0x10000);
+  unsigned failed = 0;
+
+  for (unsigned it = 0; it < ITERATIONS; it++) {
+    for (unsigned i = 0; i < WORDS_PER_HART; i++) {
+      data[i] = i + it + hartid;
+    }
+    unsigned sum = 0;
+    for (unsigned i = 0; i < WORDS_PER_HART; i++) {
+      sum += data[i];
+    }
+    const unsigned n = WORDS_PER_HART;
+    if (sum != n * (n - 1) / 2 + n * (it + hartid)) {
+      failed = 1;
+    }
+  }
+  return failed;
+}
+
+// Every hart runs the same workload on its own data, hart 0 reports the result once all
+// configured harts are done. Counting only the harts that already started would let hart 0
+// finish before a slow hart got to run at all.
+int main () {
+  const unsigned hartid = cpu_get_current_hartid();
+
+  if (task_fill_sum(hartid)) {
+    atomic_inc(p_harts_failed);
+  }
+  __asm__ __volatile__("fence;");
+  atomic_inc(p_harts_done);
+
+  if (hartid == 0) {
+    while (*p_harts_done != *p_hart_count) {
+    }
+    *p_finisher = *p_harts_failed ? 0x1 : 0x5555;
+  }
+  while (1) {
+    __asm__("nop; nop;");
+  }
+  return 0;
+}
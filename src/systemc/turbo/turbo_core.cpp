@@ -5,7 +5,9 @@
 #include "riscv/devices.h"      
 #include "riscv/log_file.h"     
 #include "riscv/remote_bitbang.h"
-// #include <tlm/scc/tlm_mm.h>
+#include "riscv/extension.h"
+#include "util/hart_state.h"
+#include "util/host_prof.h"
 
 
 turbo_core::turbo_core(sc_module_name nm, const cfg_t* cfg, const debug_module_config_t& dm_config)
@@ -19,20 +21,9 @@ turbo_core::turbo_core(sc_module_name nm, const cfg_t* cfg, const debug_module_c
     sim_start_time = std::chrono::high_resolution_clock::now();
     last_report_time = sim_start_time;
     instructions_at_last_report = 0;
-    total_instructions_executed = 0;
     #endif
 
     assert(cfg != nullptr && "cfg cannot be nullptr");
-    // SystemC processes
-    SC_THREAD(run_m);
-    sensitive << start_ev;
-    dont_initialize();
-
-    mem_trans = new tlm::tlm_generic_payload;// TODO: fix tlm::scc::tlm_mm<>::get().allocate<axi::ace_extension>(1024);
-    mem_trans->set_data_length(4096);
-    unsigned char* data_ptr = new unsigned char[4096];
-    mem_trans->set_data_ptr(data_ptr);
-
     // CPUs
     procs.reserve(cfg->nprocs());
 
@@ -54,23 +45,237 @@ turbo_core::turbo_core(sc_module_name nm, const cfg_t* cfg, const debug_module_c
     for(const auto& proc : procs) {
         proc->set_debug(false);
     }
+    if (procs.size() > 1) {
+        for (auto& proc : procs) {
+            atomics.push_back(std::make_unique<serialized_atomics>(this));
+            proc->register_extension(atomics.back().get());
+        }
+    }
+
+    // SystemC processes, harts progress concurrently and interleave their traffic at the uncore
+    for(unsigned i = 0; i < procs.size(); i++) {
+        qk.push_back(std::make_unique<tlm_utils::tlm_quantumkeeper>());
+        accounted_instret.push_back(0);
+        sc_spawn(sc_bind(&turbo_core::run_hart, this, i), ("hart_" + std::to_string(i)).c_str());
+    }
 
     bus = std::make_unique<bus_t>();
     bus->add_device(0x0, &debug_module);
 
     configure_log(false);
     init_socket.register_nb_transport_bw(this, &turbo_core::nb_transport);
+    init_socket.register_invalidate_direct_mem_ptr(this, &turbo_core::invalidate_direct_mem_ptr);
+    register_stats();
+
+}
+
+void turbo_core::register_stats() {
+    auto& reg = util::stats_registry::instance();
+    const std::string prefix = std::string(name()) + ".";
+    for (size_t i = 0; i < procs.size(); i++) {
+        processor_t* proc = procs[i];
+        reg.add(prefix + "hart" + std::to_string(i) + ".instret",
+                [proc]() { return double(proc->get_state()->minstret->read()); });
+    }
+    reg.add(prefix + "instret", [this]() { return double(instret()); });
+    reg.add(prefix + "loads", &stats.loads);
+    reg.add(prefix + "stores", &stats.stores);
+    reg.add(prefix + "bytes_read", &stats.bytes_read);
+    reg.add(prefix + "bytes_written", &stats.bytes_written);
+    reg.add(prefix + "device_accesses", &stats.device_accesses);
+    reg.add(prefix + "avg_latency_ns", [this]() {
+        return stats.transactions ? stats.latency_ns / stats.transactions : 0.0;
+    });
+    reg.add(prefix + "posted_max", &stats.posted_max);
+    reg.add(prefix + "payloads_allocated", [this]() { return double(mm.allocations()); });
+    reg.add(prefix + "dmi_regions", [this]() { return double(dmi_regions.size()); });
+}
+
+uint64_t turbo_core::instret() const {
+    uint64_t total = 0;
+    for (auto& proc : procs) {
+        total += proc->get_state()->minstret->read();
+    }
+    return total;
+}
 
+void turbo_core::save_state(util::checkpoint_writer& ckpt) {
+    for (size_t i = 0; i < procs.size(); i++) {
+        ckpt.add("hart" + std::to_string(i), util::save_hart_state(procs[i]));
+    }
+}
+
+void turbo_core::restore_state(const util::checkpoint_reader& ckpt) {
+    if (ckpt.has("hart" + std::to_string(procs.size()))) {
+        throw std::runtime_error("checkpoint was taken with more harts");
+    }
+    for (size_t i = 0; i < procs.size(); i++) {
+        auto hart = ckpt.get("hart" + std::to_string(i));
+        util::restore_hart_state(procs[i], hart.first, hart.second);
+        accounted_instret[i] = procs[i]->get_state()->minstret->read();
+    }
+    // host pointers into the memory the checkpoint replaced
+    dmi_regions.clear();
+}
+
+// the last hart to arrive saves the checkpoint, every other one is parked between two quanta
+void turbo_core::checkpoint_barrier() {
+    drain_posted();
+    if (++checkpoint_parked < procs.size()) {
+        hart_wait(checkpoint_done_event);
+        return;
+    }
+    LOG_DBG("saving checkpoint after " << dec << instret() << " instructions");
+    checkpoint_parked = 0;
+    checkpoint_save();
+    if (checkpoint_interval) {
+        checkpoint_after = instret() + checkpoint_interval;
+    } else {
+        checkpoint_save = nullptr;
+    }
+    checkpoint_done_event.notify(SC_ZERO_TIME);
 }
 
 char* turbo_core::addr_to_mem(reg_t paddr) { 
-    return nullptr;
+    if (!dmi || is_spike_device_addr(paddr)) {
+        return nullptr;
+    }
+    // Spike may access the page directly from now on
+    drain_posted();
+    const tlm::tlm_dmi* region = find_dmi(paddr);
+    if (region == nullptr) {
+        tlm::tlm_generic_payload trans;
+        trans.set_command(tlm::TLM_READ_COMMAND);
+        trans.set_address(paddr);
+        tlm::tlm_dmi dmi_data;
+        init_socket->get_direct_mem_ptr(trans, dmi_data);
+        LOG_DBG("DMI " << (dmi_data.is_read_write_allowed() ? "granted" : "denied") << " for 0x" << hex
+                << dmi_data.get_start_address() << " - 0x" << dmi_data.get_end_address());
+        if (!dmi_data.is_read_write_allowed()) {
+            // Spike needs read and write access to the page
+            dmi_data.set_dmi_ptr(nullptr);
+            dmi_data.set_granted_access(tlm::tlm_dmi::DMI_ACCESS_NONE);
+        }
+        if (paddr < dmi_data.get_start_address() || paddr > dmi_data.get_end_address()) {
+            // the target did not describe a range covering paddr, ask again next time
+            return nullptr;
+        }
+        region = &(dmi_regions[dmi_data.get_start_address()] = dmi_data);
+    }
+    if (region->get_granted_access() == tlm::tlm_dmi::DMI_ACCESS_NONE) {
+        return nullptr;
+    }
+    return (char*)region->get_dmi_ptr() + (paddr - region->get_start_address());
+}
+
+// Spike's implementations of the AMOs, exported by libriscv
+#define AMO_INSNS(X) \
+    X(amoswap_w, AMOSWAP_W) X(amoswap_d, AMOSWAP_D) X(amoadd_w, AMOADD_W) X(amoadd_d, AMOADD_D) \
+    X(amoxor_w, AMOXOR_W) X(amoxor_d, AMOXOR_D) X(amoand_w, AMOAND_W) X(amoand_d, AMOAND_D) \
+    X(amoor_w, AMOOR_W) X(amoor_d, AMOOR_D) X(amomin_w, AMOMIN_W) X(amomin_d, AMOMIN_D) \
+    X(amomax_w, AMOMAX_W) X(amomax_d, AMOMAX_D) X(amominu_w, AMOMINU_W) X(amominu_d, AMOMINU_D) \
+    X(amomaxu_w, AMOMAXU_W) X(amomaxu_d, AMOMAXU_D)
+
+#define DECLARE_SPIKE_INSN(name, NAME) \
+    extern reg_t fast_rv32i_##name(processor_t*, insn_t, reg_t); \
+    extern reg_t fast_rv64i_##name(processor_t*, insn_t, reg_t); \
+    extern reg_t fast_rv32e_##name(processor_t*, insn_t, reg_t); \
+    extern reg_t fast_rv64e_##name(processor_t*, insn_t, reg_t); \
+    extern reg_t logged_rv32i_##name(processor_t*, insn_t, reg_t); \
+    extern reg_t logged_rv64i_##name(processor_t*, insn_t, reg_t); \
+    extern reg_t logged_rv32e_##name(processor_t*, insn_t, reg_t); \
+    extern reg_t logged_rv64e_##name(processor_t*, insn_t, reg_t);
+AMO_INSNS(DECLARE_SPIKE_INSN)
+#undef DECLARE_SPIKE_INSN
+
+// Registered as a custom extension its instructions take precedence over Spike's, they run
+// Spike's own implementation with atomic_owner set. A hart thread may wait between the AMO's
+// load and store transaction, the other harts' transactions wait for the AMO to finish.
+// Through DMI an AMO does not wait, LR/SC is only allowed there (reservable)
+class turbo_core::serialized_atomics : public extension_t {
+public:
+    explicit serialized_atomics(turbo_core* core) : core(core) {}
+
+    const char* name() const override { return "turbo_core_atomics"; }
+
+    std::vector<insn_desc_t> get_instructions(const processor_t&) override {
+        std::vector<insn_desc_t> insns;
+#define SERIALIZED_INSN(name, NAME) \
+        insns.push_back({MATCH_##NAME, MASK_##NAME, \
+                         run<fast_rv32i_##name>, run<fast_rv64i_##name>, \
+                         run<fast_rv32e_##name>, run<fast_rv64e_##name>, \
+                         run<logged_rv32i_##name>, run<logged_rv64i_##name>, \
+                         run<logged_rv32e_##name>, run<logged_rv64e_##name>});
+        AMO_INSNS(SERIALIZED_INSN)
+#undef SERIALIZED_INSN
+        return insns;
+    }
+
+    std::vector<disasm_insn_t*> get_disasms(const processor_t*) override { return {}; }
+
+private:
+    template <insn_func_t F> static reg_t run(processor_t* p, insn_t insn, reg_t pc) {
+        turbo_core* core = static_cast<serialized_atomics*>(p->get_extension("turbo_core_atomics"))->core;
+        core->wait_for_atomic();
+        core->atomic_owner = core->current_proc;
+        reg_t npc;
+        try {
+            npc = F(p, insn, pc);
+        } catch (...) {
+            // faults of the access are taken as traps by the hart
+            core->atomic_owner = -1;
+            core->atomic_done_event.notify(SC_ZERO_TIME);
+            throw;
+        }
+        core->atomic_owner = -1;
+        core->atomic_done_event.notify(SC_ZERO_TIME);
+        return npc;
+    }
+
+    turbo_core* const core;
+};
+
+turbo_core::~turbo_core() = default;
+
+void turbo_core::wait_for_atomic() {
+    while (atomic_owner >= 0 && unsigned(atomic_owner) != current_proc) {
+        hart_wait(atomic_done_event);
+    }
 }
 
 bool turbo_core::reservable(reg_t paddr) {
-    // Implementation depends on your memory model
-    // This is a placeholder implementation
-    return false;
+    // LR/SC is only supported on directly accessed memory
+    return addr_to_mem(paddr) != nullptr;
+}
+
+const tlm::tlm_dmi* turbo_core::find_dmi(reg_t paddr) {
+    auto it = dmi_regions.upper_bound(paddr);
+    if (it == dmi_regions.begin()) {
+        return nullptr;
+    }
+    --it;
+    return paddr <= it->second.get_end_address() ? &it->second : nullptr;
+}
+
+void turbo_core::set_dmi(bool enable) {
+    dmi = enable;
+    invalidate_direct_mem_ptr(0, ~sc_dt::uint64(0));
+}
+
+void turbo_core::invalidate_direct_mem_ptr(sc_dt::uint64 start, sc_dt::uint64 end) {
+    LOG_DBG("DMI invalidated for 0x" << hex << start << " - 0x" << end);
+    auto it = dmi_regions.begin();
+    while (it != dmi_regions.end()) {
+        if (it->second.get_start_address() <= end && it->second.get_end_address() >= start) {
+            it = dmi_regions.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    // Spike's TLBs still hold host pointers into the invalidated regions
+    for (auto& proc : procs) {
+        proc->get_mmu()->flush_tlb();
+    }
 }
 
 // if we want to include more devices which will be on the bus
@@ -82,60 +287,215 @@ bool turbo_core::is_spike_device_addr(reg_t paddr) {
 bool turbo_core::mmio_load(reg_t paddr, size_t len, uint8_t* bytes) {
     LOG_DBG("mmio_load called for address 0x" << hex << paddr);
     if (is_spike_device_addr(paddr)) {
+        quantum_ctl.note_activity();
         return bus->load(paddr, len, bytes);
     }
 
-    tlm::tlm_phase phase = tlm::BEGIN_REQ;
-    sc_time delay{SC_ZERO_TIME};
-    tlm::tlm_generic_payload trans;
-    trans.set_command(tlm::TLM_READ_COMMAND);
-    trans.set_address(paddr);
-    // TODO: check if memcpy is better
-    trans.set_data_ptr(bytes);
-    trans.set_data_length(len);
-    turbo_tlm_extension* ext = new turbo_tlm_extension();
-    ext->coreId = current_proc;
-    trans.set_extension(ext);
-
-    auto status = nb_transport(trans, phase, delay);
-    wait(done_event);
-    return status;
+    return transport(tlm::TLM_READ_COMMAND, paddr, len, bytes);
 }
 
 bool turbo_core::mmio_store(reg_t paddr, size_t len, const uint8_t* bytes) {
     LOG_DBG("mmio_store called for address 0x" << hex << paddr);
     if (is_spike_device_addr(paddr)) { // TODO: DO propper address mapping
+        quantum_ctl.note_activity();
         return bus->store(paddr, len, bytes);
     }
+    return transport(tlm::TLM_WRITE_COMMAND, paddr, len, const_cast<uint8_t*>(bytes));
+}
+
+// sends one access to the uncore and returns once it has completed. Payloads come from the pool
+// with the extension still attached from their previous use, so a warm pool does not allocate
+bool turbo_core::transport(tlm::tlm_command cmd, reg_t paddr, size_t len, uint8_t* bytes) {
+    tlm::tlm_generic_payload* trans = mm.allocate();
+    trans->acquire();
+    trans->set_command(cmd);
+    trans->set_address(paddr);
+    trans->set_data_ptr(bytes);
+    trans->set_data_length(len);
+    trans->set_streaming_width(len);
+    turbo_tlm_extension* ext = trans->get_extension<turbo_tlm_extension>();
+    if (ext == nullptr) {
+        ext = new turbo_tlm_extension();
+        trans->set_extension(ext);
+    }
+    const unsigned hart = current_proc;
+    ext->coreId = hart;
+    ext->device_access = false;
+    ext->id = next_trans_id++;
+    ext->posted = false;
+    ext->done = false;
+    if (cmd == tlm::TLM_READ_COMMAND) {
+        stats.loads++;
+        stats.bytes_read += len;
+    } else {
+        stats.stores++;
+        stats.bytes_written += len;
+    }
+
+    wait_for_atomic();
+    if (posted_stores && !lt) {
+        if (cmd == tlm::TLM_WRITE_COMMAND && len <= sizeof(ext->store_data)) {
+            return post_store(trans, ext);
+        }
+        wait_for_posted(paddr, len);
+    }
+
+    bool ok;
+    if (lt) {
+        // blocking transport, the annotated delay is accumulated in the quantum keeper instead of waited.
+        // The instructions before this access take their time first, the target sees when it was issued
+        account_instructions(hart);
+        const sc_time issued = qk[hart]->get_local_time();
+        sc_time delay = issued;
+        init_socket->b_transport(*trans, delay);
+        stats.latency_ns += (delay - issued).to_seconds() * 1e9;
+        qk[hart]->set(delay);
+        if (qk[hart]->need_sync()) {
+            hart_sync();
+        }
+        ok = trans->is_response_ok();
+    } else {
+        tlm::tlm_phase phase = tlm::BEGIN_REQ;
+        sc_time delay{SC_ZERO_TIME};
+        const sc_time issued = sc_time_stamp();
+        auto status = nb_transport(*trans, phase, delay);
+        while (status != tlm::TLM_COMPLETED && !ext->done) {
+            hart_wait(done_event);
+        }
+        if (status == tlm::TLM_COMPLETED && delay != SC_ZERO_TIME) {
+            // completed at once, e.g. by a cache in the uncore, with its latency annotated
+            hart_wait(delay);
+        }
+        stats.latency_ns += (sc_time_stamp() - issued).to_seconds() * 1e9;
+        ok = status == tlm::TLM_COMPLETED || trans->is_response_ok();
+    }
+    stats.transactions++;
+    if (ext->device_access) {
+        stats.device_accesses++;
+        quantum_ctl.note_activity();
+    }
+    trans->release();
+    return ok;
+}
+
+// the store data is copied into the extension, Spike's buffer is gone once mmio_store returns
+bool turbo_core::post_store(tlm::tlm_generic_payload* trans, turbo_tlm_extension* ext) {
+    while (posted.size() >= max_posted) {
+        hart_wait(posted_done_event);
+    }
+    std::memcpy(ext->store_data, trans->get_data_ptr(), trans->get_data_length());
+    trans->set_data_ptr(ext->store_data);
+    ext->posted = true;
+
     tlm::tlm_phase phase = tlm::BEGIN_REQ;
     sc_time delay{SC_ZERO_TIME};
-    tlm::tlm_generic_payload trans;
-    trans.set_command(tlm::TLM_WRITE_COMMAND);
-    trans.set_address(paddr);
-    trans.set_data_ptr(const_cast<unsigned char*>(bytes));
-    trans.set_data_length(len);
-    turbo_tlm_extension* ext = new turbo_tlm_extension();
-    ext->coreId = current_proc;
-    trans.set_extension(ext);
-    auto status = nb_transport(trans, phase, delay);
-    wait(done_event);
-    return status;
+    auto status = nb_transport(*trans, phase, delay);
+    if (ext->device_access) {
+        stats.device_accesses++;
+        quantum_ctl.note_activity();
+    }
+    if (status == tlm::TLM_COMPLETED || ext->done) {
+        trans->release();
+    } else {
+        LOG_DBG("posted store " << dec << ext->id << " to 0x" << hex << trans->get_address());
+        posted[ext->id] = trans;
+        stats.posted_max = std::max<uint64_t>(stats.posted_max, posted.size());
+    }
+    return true;
+}
+
+void turbo_core::wait_for_posted(reg_t paddr, size_t len) {
+    auto overlaps = [&]() {
+        for (auto& p : posted) {
+            const uint64_t addr = p.second->get_address();
+            if (addr < paddr + len && paddr < addr + p.second->get_data_length()) {
+                return true;
+            }
+        }
+        return false;
+    };
+    while (overlaps()) {
+        hart_wait(posted_done_event);
+    }
+}
+
+void turbo_core::drain_posted() {
+    while (!posted.empty()) {
+        hart_wait(posted_done_event);
+    }
+}
+
+void turbo_core::set_lt(bool enable, const sc_time& cycle) {
+    lt = enable;
+    cycle_time = cycle;
+    for (size_t i = 0; i < procs.size(); i++) {
+        qk[i]->reset();
+        accounted_instret[i] = procs[i]->get_state()->minstret->read();
+    }
+}
+
+// minstret only moves forward unless the guest writes it, then the next instructions start over
+void turbo_core::account_instructions(unsigned hart) {
+    const uint64_t retired = procs[hart]->get_state()->minstret->read();
+    if (retired > accounted_instret[hart]) {
+        qk[hart]->inc(double(retired - accounted_instret[hart]) * cycle_time);
+    }
+    accounted_instret[hart] = retired;
+}
+
+// another hart's thread may run while this one waits and changes current_proc
+void turbo_core::hart_wait(const sc_event& ev) {
+    const unsigned hart = current_proc;
+    HOST_PROF_YIELD();
+    wait(ev);
+    hart_resume(hart);
+}
+
+void turbo_core::hart_wait(const sc_time& t) {
+    const unsigned hart = current_proc;
+    HOST_PROF_YIELD();
+    wait(t);
+    hart_resume(hart);
+}
+
+void turbo_core::hart_sync() {
+    const unsigned hart = current_proc;
+    HOST_PROF_YIELD();
+    qk[hart]->sync();
+    hart_resume(hart);
+}
+
+// every hart's thread sets current_proc when it runs. Another hart may have stored to the
+// reserved address in the meantime, without tracking its stores the reservation is given up
+void turbo_core::hart_resume(unsigned hart) {
+    if (current_proc != hart) {
+        procs[hart]->get_mmu()->yield_load_reservation();
+        current_proc = hart;
+    }
 }
 
 tlm::tlm_sync_enum turbo_core::nb_transport(tlm::tlm_generic_payload& trans, tlm::tlm_phase& phase, sc_time& delay) {
+    HOST_PROF_SCOPE("turbo_core::nb_transport");
     LOG_DBG("nb_transport called with phase " << phase);
     LOG_DBG("addr = 0x" << hex << trans.get_address());
 
     if (phase == tlm::BEGIN_REQ) {
-        // this is from MMIO funcs
-        sc_time t{SC_ZERO_TIME};
-        auto end_req_reply = init_socket->nb_transport_fw(trans, phase, t);
-        
+        // this is from MMIO funcs, devices complete the access immediately
+        return init_socket->nb_transport_fw(trans, phase, delay);
     } else if (phase == tlm::END_REQ){
         return tlm::TLM_ACCEPTED;
     }
     else if (phase == tlm::BEGIN_RESP) {
-        done_event.notify(SC_ZERO_TIME);        
+        // responses may arrive out of order, complete the transaction they belong to
+        turbo_tlm_extension* ext = trans.get_extension<turbo_tlm_extension>();
+        ext->done = true;
+        if (ext->posted && posted.erase(ext->id)) {
+            LOG_DBG("posted store " << dec << ext->id << " done");
+            trans.release();
+            posted_done_event.notify(SC_ZERO_TIME);
+        } else {
+            done_event.notify(SC_ZERO_TIME);
+        }
     }
     return tlm::TLM_COMPLETED;
 }
@@ -155,19 +515,87 @@ const cfg_t& turbo_core::get_cfg() const {
 }
 
 const char* turbo_core::get_symbol(uint64_t paddr) {
-    // This is a placeholder implementation
-    return nullptr;
+    // Spike asks for every logged pc and prints a symbol starting there
+    auto sym = symbols.at(paddr);
+    return sym ? sym->name : nullptr;
 }
 
-void turbo_core::run_m() {
+void turbo_core::enable_profiler(uint64_t interval) {
+    if (interval) {
+        prof = std::make_unique<util::pc_profiler>(procs.size(), interval);
+    } else {
+        prof.reset();
+    }
+}
+
+// posted stores still on their way are not seen
+bool turbo_core::read_debug(uint64_t addr, void* data, size_t len) {
+    tlm::tlm_generic_payload trans;
+    trans.set_command(tlm::TLM_READ_COMMAND);
+    trans.set_address(addr);
+    trans.set_data_ptr(static_cast<unsigned char*>(data));
+    trans.set_data_length(len);
+    return init_socket->transport_dbg(trans) == len;
+}
+
+void turbo_core::run_hart(unsigned id) {
+    wait(start_ev);
+    current_proc = id;
+    accounted_instret[id] = procs[id]->get_state()->minstret->read();
     while(1) {
-        simulate_n_cycles(STEP_CYCLES);
+        const size_t cycles = quantum_ctl.get();
+        // the profiler cuts the quantum where the hart is due for a sample
+        for (size_t left = cycles; left > 0;) {
+            const size_t slice = prof ? std::min<uint64_t>(left, prof->until_sample(id)) : left;
+            {
+                HOST_PROF_SCOPE("processor_t::step");
+                procs[id]->step(slice);
+            }
+            left -= slice;
+            if (prof && prof->advance(id, slice)) {
+                prof->sample(id, procs[id], [this](uint64_t addr, void* data, size_t len) {
+                    return read_debug(addr, data, len);
+                });
+            }
+        }
         #ifdef MEASURE_PERF
-        total_instructions_executed += STEP_CYCLES;
-        if (total_instructions_executed % PERF_REPORT_INTERVAL == 0) {
+        if (instret() - instructions_at_last_report >= PERF_REPORT_INTERVAL) {
             report_performance();
         }
         #endif
+        if (checkpoint_save && instret() >= checkpoint_after) {
+            checkpoint_barrier();
+        }
+        if (id == 0 && remote_bitbang) {
+            this->remote_bitbang->tick();
+        }
+        // hart 0 drives the adaptive quantum for all harts
+        if (id == 0 && quantum_ctl.is_adaptive()) {
+            // a halted hart or a pending interrupt needs a prompt reaction. Remote bitbang's
+            // tick() does not tell whether it served commands, a debugger polling running
+            // harts is answered once per quantum
+            bool urgent = false;
+            for (auto& proc : procs) {
+                auto* state = proc->get_state();
+                urgent |= state->debug_mode || (state->mip->read() & state->mie->read());
+            }
+            if (urgent) {
+                quantum_ctl.request_min();
+            }
+            quantum_ctl.next();
+        }
+        if (lt) {
+            // harts are decoupled from the kernel until the global quantum is used up. Only the
+            // instructions retired since the last transaction are left, a trap may end step() early
+            account_instructions(id);
+            if (qk[id]->need_sync()) {
+                hart_sync();
+            }
+        } else {
+            // with DMI a quantum may not touch the interconnect at all, give the other harts a turn
+            wait(SC_ZERO_TIME);
+            hart_resume(id);
+        }
     }
 }
 
@@ -177,13 +605,15 @@ void turbo_core::report_performance()
   auto current_time = std::chrono::high_resolution_clock::now();
   auto elapsed_since_last = std::chrono::duration_cast<std::chrono::microseconds>(current_time - last_report_time);
 
+  const uint64_t total_instructions_executed = instret();
   uint64_t instructions_since_last = total_instructions_executed - instructions_at_last_report;
 
   if (elapsed_since_last.count() > 0) {
     double interval_seconds = elapsed_since_last.count() / (1000000.0);
     double current_mhz = (instructions_since_last / interval_seconds) / 1000000.0;
-    fprintf(stderr, "Sim speed: %.2f MHz (%llu instructions, %.3f ms)\n", 
-            current_mhz, total_instructions_executed, elapsed_since_last.count() / 1000.0);
+    fprintf(stderr, "Sim speed: %.2f MHz (%llu instructions, %.3f ms, %llu payloads allocated)\n", 
+            current_mhz, (unsigned long long)total_instructions_executed, elapsed_since_last.count() / 1000.0,
+            (unsigned long long)mm.allocations());
   }
   
   last_report_time = current_time;
@@ -201,13 +631,3 @@ void turbo_core::configure_log(bool enable_log) {
     }
 }
 
-inline void turbo_core::simulate_n_cycles(size_t cycles)  {
-        current_proc = 0;
-
-        for(auto& proc : procs) {
-            proc->step(cycles);
-            current_proc++;
-        }
-        if (remote_bitbang)
-            this->remote_bitbang->tick();
-    }
@@ -1,6 +1,9 @@
 #ifndef TURBO_CORE_H
 #define TURBO_CORE_H
 
+#ifndef SC_INCLUDE_DYNAMIC_PROCESSES
+#define SC_INCLUDE_DYNAMIC_PROCESSES // sc_spawn for the hart threads
+#endif
 #include <systemc>
 using namespace sc_core;
 using namespace std;
@@ -8,6 +11,8 @@ using namespace std;
 #include <tlm.h>
 using namespace tlm;
 #include <tlm_utils/simple_initiator_socket.h>
+#include <tlm_utils/tlm_quantumkeeper.h>
+#include <functional>
 
 #include "riscv/processor.h"
 #include "riscv/simif.h"      // needed for base class
@@ -18,6 +23,13 @@ using namespace tlm;
 #include "riscv/log_file.h"   // for log_file_t
 #include "riscv/debug_module.h"
 #include "util/dbg_component.h" // needed for debug_component class
+#include "util/quantum_controller.h"
+#include "util/tlm_mm.h"
+#include "util/stats.h"
+#include "util/checkpoint.h"
+#include "util/symbol_index.h"
+#include "util/pc_profiler.h"
+#include "turbo_tlm_extension.h"
 class remote_bitbang_t;
 
 
@@ -25,22 +37,12 @@ class remote_bitbang_t;
 #include <chrono>
 #endif
 
-class turbo_tlm_extension : public tlm_extension<turbo_tlm_extension> {
-public:
-    turbo_tlm_extension() {}
-    ~turbo_tlm_extension() {}
-    void copy_from(tlm_extension_base const& ext) {}
-    tlm_extension_base* clone() const override { return new turbo_tlm_extension(); }
-    std::type_index get_type() const { return typeid(turbo_tlm_extension); }
-    
-    uint64_t coreId{0};
-};
 class turbo_core : public simif_t, public sc_module, public debug_component {
     SC_HAS_PROCESS(turbo_core);
 
 public:
     turbo_core(sc_module_name nm, const cfg_t* cfg, const debug_module_config_t& dm_config);
-    ~turbo_core() = default;
+    ~turbo_core();
 
     // TLM sockets
     tlm_utils::simple_initiator_socket<turbo_core, 256 /*width*/, tlm::tlm_base_protocol_types>
@@ -48,19 +50,23 @@ public:
 
     // functionalities for running and stopping simulation
     sc_event SC_NAMED(start_ev);
-    void run_m(); // running method. let it stay method for now
+    void run_hart(unsigned id); // one thread per hart, spawned in the constructor
     
     void trigger_start() { 
         start_ev.notify(SC_ZERO_TIME); 
     }
 
-    inline void simulate_n_cycles(size_t cycles);
-
     void end_simulation() {
+        util::log_writer::instance().flush();
         cout << "Now is the end of simulation @ " << sc_time_stamp() << endl;
         sc_core::sc_stop();
     }
 
+    // records still queued for the log writer are written before sc_start returns
+    void end_of_simulation() override {
+        util::log_writer::instance().flush();
+    }
+
     // bool send_tlm(reg_t paddr, size_t len, const uint8_t* bytes, bool is_write);
 
     // pure virtual functions from simif_t
@@ -76,11 +82,52 @@ public:
 
     processor_t* get_core(size_t i) { return procs.at(i); }
 
+    // instructions per hart between synchronization points, fixed 5000 by default
+    util::quantum_controller& quantum() { return quantum_ctl; }
+
+    // symbols of the loaded program for get_symbol, pass to MemoryLoader::loadElf
+    util::symbol_index& symbol_table() { return symbols; }
+
+    // sample the pc and call stack of every hart about every interval instructions
+    // (util/pc_profiler.h), 0 stops sampling
+    void enable_profiler(uint64_t interval = 10000);
+    util::pc_profiler* profiler() { return prof.get(); }
+
+    // let Spike access memory directly through TLM DMI, timed AT transactions otherwise
+    void set_dmi(bool enable);
+    void invalidate_direct_mem_ptr(sc_dt::uint64 start, sc_dt::uint64 end);
+
+    // loosely-timed mode: b_transport with temporal decoupling up to the TLM global quantum,
+    // every retired instruction is accounted as one cycle before the hart's next transaction
+    void set_lt(bool enable, const sc_time& cycle = sc_time(10, SC_NS));
+
+    // AT mode only: stores return before the memory responds, at most max_posted are in flight.
+    // Loads overlapping an outstanding store wait for it
+    void set_posted_stores(bool enable, size_t max_posted = 16) {
+        posted_stores = enable;
+        this->max_posted = max_posted;
+    }
+
+    // instructions retired by all harts, read from minstret
+    uint64_t instret() const;
+
+    // state of all harts as sections "hart<n>" of a checkpoint. Restore before the simulation
+    // starts, the harts must be configured as they were when the checkpoint was taken
+    void save_state(util::checkpoint_writer& ckpt);
+    void restore_state(const util::checkpoint_reader& ckpt);
+    // once the harts retired `after` instructions in total, every hart stops at the end of its
+    // quantum and waits for its posted stores, then save runs with the whole platform quiet.
+    // With an interval save runs again every interval instructions
+    void request_checkpoint(uint64_t after, std::function<void()> save, uint64_t interval = 0) {
+        checkpoint_after = after;
+        checkpoint_interval = interval;
+        checkpoint_save = std::move(save);
+    }
+
     #ifdef MEASURE_PERF
     static const uint64_t PERF_REPORT_INTERVAL = 10000;
     std::chrono::high_resolution_clock::time_point sim_start_time;
     std::chrono::high_resolution_clock::time_point last_report_time;
-    uint64_t total_instructions_executed;
     uint64_t instructions_at_last_report;
     void report_performance();
     #endif
@@ -105,19 +152,76 @@ private:
     std::map<size_t, processor_t*> harts;
 
     // counting instructions
-    static constexpr uint64_t STEP_CYCLES = 5000;
+    util::quantum_controller quantum_ctl;
     // isa-related
     isa_parser_t isa;
     const cfg_t* const cfg;
-    std::map<std::string, uint64_t> symbols;
+    util::symbol_index symbols;
+    std::unique_ptr<util::pc_profiler> prof;
+    // untimed read through the debug transport, for unwinding guest stacks
+    bool read_debug(uint64_t addr, void* data, size_t len);
+    // published to util::stats_registry
+    struct {
+        uint64_t loads{0};
+        uint64_t stores{0};
+        uint64_t bytes_read{0};
+        uint64_t bytes_written{0};
+        uint64_t device_accesses{0};
+        uint64_t transactions{0};
+        double latency_ns{0};     // sum over transactions, issue to response
+        uint64_t posted_max{0};   // highest number of outstanding posted stores
+    } stats;
+    void register_stats();
     // TLM functionalities
-    tlm::tlm_generic_payload* mem_trans{nullptr};
+    util::tlm_mm mm;
+    uint64_t next_trans_id{0};
+    bool transport(tlm::tlm_command cmd, reg_t paddr, size_t len, uint8_t* bytes);
+    // posted stores by transaction id
+    bool posted_stores{false};
+    size_t max_posted{16};
+    std::map<uint64_t, tlm::tlm_generic_payload*> posted;
+    sc_event SC_NAMED(posted_done_event);
+    bool post_store(tlm::tlm_generic_payload* trans, turbo_tlm_extension* ext);
+    void wait_for_posted(reg_t paddr, size_t len);
+    void drain_posted();
     tlm::tlm_sync_enum nb_transport(tlm::tlm_generic_payload& trans, tlm::tlm_phase& phase, sc_time& delay);
     sc_event SC_NAMED(done_event);
+    // DMI regions by start address, denied ranges are kept with DMI_ACCESS_NONE so they are
+    // not requested again
+    bool dmi{false};
+    std::map<uint64_t, tlm::tlm_dmi> dmi_regions;
+    const tlm::tlm_dmi* find_dmi(reg_t paddr);
+    // loosely-timed mode
+    bool lt{false};
+    sc_time cycle_time{10, SC_NS};
+    std::vector<std::unique_ptr<tlm_utils::tlm_quantumkeeper>> qk; // per hart
+    std::vector<uint64_t> accounted_instret; // per hart, minstret already added to its local time
+    void account_instructions(unsigned hart);
+
+    // checkpoint requested through request_checkpoint
+    uint64_t checkpoint_after{0};
+    uint64_t checkpoint_interval{0};
+    std::function<void()> checkpoint_save;
+    size_t checkpoint_parked{0};
+    sc_event SC_NAMED(checkpoint_done_event);
+    void checkpoint_barrier();
 
     // for GDB
     remote_bitbang_t* remote_bitbang{nullptr};
-    unsigned current_proc{0};
+    unsigned current_proc{0}; // hart whose thread is running, restored after every wait
+    void hart_wait(const sc_event& ev);
+    void hart_wait(const sc_time& t);
+    void hart_sync();
+    // called by a hart's thread after every wait, drops its LR reservation if another hart ran
+    void hart_resume(unsigned hart);
+    // AMOs without DMI are a load and a store transaction, other harts must not access the
+    // interconnect in between. atomic_owner is the hart in the middle of an AMO,
+    // -1 for none
+    class serialized_atomics;
+    std::vector<std::unique_ptr<serialized_atomics>> atomics;
+    int atomic_owner{-1};
+    sc_event SC_NAMED(atomic_done_event);
+    void wait_for_atomic();
 
     public:
     debug_module_t debug_module;
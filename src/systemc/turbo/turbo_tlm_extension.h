@@ -0,0 +1,37 @@
+#ifndef TURBO_TLM_EXTENSION_H
+#define TURBO_TLM_EXTENSION_H
+
+#include <tlm.h>
+#include <cstring>
+#include <typeindex>
+
+// attached by turbo_core to every transaction it issues
+class turbo_tlm_extension : public tlm::tlm_extension<turbo_tlm_extension> {
+public:
+    turbo_tlm_extension() {}
+    ~turbo_tlm_extension() {}
+    void copy_from(tlm::tlm_extension_base const& ext) {
+        const auto& other = static_cast<const turbo_tlm_extension&>(ext);
+        coreId = other.coreId;
+        device_access = other.device_access;
+        id = other.id;
+        posted = other.posted;
+        done = other.done;
+        std::memcpy(store_data, other.store_data, sizeof(store_data));
+    }
+    tlm::tlm_extension_base* clone() const override {
+        auto* ext = new turbo_tlm_extension();
+        ext->copy_from(*this);
+        return ext;
+    }
+    std::type_index get_type() const { return typeid(turbo_tlm_extension); }
+    
+    uint64_t coreId{0};
+    bool device_access{false}; // set by the uncore when a device, not memory, served the access
+    uint64_t id{0};            // sequence number of the transaction within its core
+    bool posted{false};        // store the core did not wait for, data lives in store_data
+    bool done{false};          // response received
+    uint8_t store_data[64];
+};
+
+#endif
@@ -4,8 +4,14 @@
 #include <tlm_utils/simple_initiator_socket.h>
 #include <tlm_utils/simple_target_socket.h>
 #include "util/dbg_component.h"
+#include "util/stats.h"
 
+#include <algorithm>
+#include <cstring>
+#include <iterator>
 #include <map>
+#include <sstream>
+#include <vector>
 
 class sc_device : public sc_module, public debug_component {
 public:
@@ -14,6 +20,16 @@ public:
     virtual ~sc_device() = default;
     virtual void write(uint64_t addr, const uint8_t* data, size_t len) {}
     virtual void read(uint64_t addr, uint8_t* data, size_t len) {} // TODO IF
+    // time taken by the last read or write
+    virtual sc_time access_latency() const { return SC_ZERO_TIME; }
+
+    // maintained by whoever routes transactions to the device
+    struct {
+        uint64_t reads{0};
+        uint64_t writes{0};
+        uint64_t bytes_read{0};
+        uint64_t bytes_written{0};
+    } traffic;
 };
 
 class sc_mem_device : public sc_device {
@@ -38,10 +54,32 @@ class sc_bus_device : public sc_module, public debug_component {
 public:
     SC_HAS_PROCESS(sc_bus_device);
 
-    sc_bus_device(sc_module_name nm): sc_module(nm), debug_component(std::string(nm)) {}
+    sc_bus_device(sc_module_name nm): sc_module(nm), debug_component(std::string(nm)) {
+        auto& reg = util::stats_registry::instance();
+        reg.add(std::string(name()) + ".lookups", &lookups);
+        reg.add(std::string(name()) + ".last_hits", &last_hits);
+    }
 
     void register_device(uint64_t base, uint64_t size, sc_device* dev) {
+        const uint64_t last = base + size - 1;
+        auto it = std::lower_bound(ranges.begin(), ranges.end(), base,
+                                   [](const range& r, uint64_t addr) { return r.last < addr; });
+        if (it != ranges.end() && it->base <= last) {
+            std::stringstream ss;
+            ss << dev->name() << " at 0x" << hex << base << " overlaps " << it->dev->name() << " at 0x" << it->base;
+            SC_REPORT_ERROR(name(), ss.str().c_str());
+            return;
+        }
+        ranges.insert(it, {base, last, dev});
+        last_hit = nullptr;
         devices_with_size[std::make_pair(base, size)] = dev;
+
+        auto& reg = util::stats_registry::instance();
+        const std::string prefix = std::string(dev->name()) + ".";
+        reg.add(prefix + "reads", &dev->traffic.reads);
+        reg.add(prefix + "writes", &dev->traffic.writes);
+        reg.add(prefix + "bytes_read", &dev->traffic.bytes_read);
+        reg.add(prefix + "bytes_written", &dev->traffic.bytes_written);
     }
 
     void register_device(sc_device* dev) {
@@ -52,14 +90,39 @@ public:
         }
     }
 
+    // binary search over the sorted ranges, consecutive accesses mostly hit the same device
     sc_device* find_device(uint64_t addr) {
-        for(auto& dev : devices_with_size) {
-            if(addr >= dev.first.first && addr < dev.first.first + dev.first.second) {
-                LOG_DBG("Found device " << dev.second->name() << " for address " << hex << addr);
-                return dev.second;
-            }
+        lookups++;
+        if (last_hit && addr - last_hit->base <= last_hit->last - last_hit->base) {
+            last_hits++;
+            return last_hit->dev;
+        }
+        auto it = std::lower_bound(ranges.begin(), ranges.end(), addr,
+                                   [](const range& r, uint64_t a) { return r.last < a; });
+        if (it == ranges.end() || it->base > addr) {
+            return nullptr;
         }
-        return nullptr;
+        LOG_DBG("Found device " << it->dev->name() << " for address " << hex << addr);
+        last_hit = &*it;
+        return it->dev;
+    }
+
+    // the device range covering addr, or the gap between the devices around addr with a null dev.
+    // Both bounds are inclusive
+    struct range {
+        uint64_t base;
+        uint64_t last; // inclusive, a range may end at the top of the address space
+        sc_device* dev;
+    };
+    range decode(uint64_t addr) const {
+        auto it = std::lower_bound(ranges.begin(), ranges.end(), addr,
+                                   [](const range& r, uint64_t a) { return r.last < a; });
+        if (it != ranges.end() && it->base <= addr) {
+            return *it;
+        }
+        const uint64_t base = it == ranges.begin() ? 0 : std::prev(it)->last + 1;
+        const uint64_t last = it == ranges.end() ? ~uint64_t(0) : it->base - 1;
+        return {base, last, nullptr};
     }
 
     void print_devices() {
@@ -73,6 +136,10 @@ public:
     }
 
 private:
+  std::vector<range> ranges; // sorted by base, non-overlapping
+  const range* last_hit{nullptr};
+  uint64_t lookups{0};
+  uint64_t last_hits{0};
   std::map<std::pair<uint64_t, uint64_t>, sc_device*> devices_with_size;
 };
 
@@ -97,6 +164,8 @@ public:
         LOG_DBG("write to " << hex << addr);
         uint64_t offset = addr - base;
         if(offset == 0x8) {
+            // the debug messages leading up to the result come first
+            util::log_writer::instance().flush();
             cout << "write to soc scr test status" << endl;
             cout << "End simulation with status: ";
             if (((uint32_t*)data)[0] == 0x5555) {
@@ -104,63 +173,285 @@ public:
             } else {
                 cout << "FAIL. Value: 0x" << hex << ((uint32_t*)data)[0] << endl;
             }
-            assert(0);
+            sc_core::sc_stop();
         }
     }
 };
 
-class sc_cache_device : public sc_device {
+// configuration of sc_cache_device, sizes must be powers of two
+struct cache_config {
+    enum class replacement { lru, plru, random };
+
+    uint64_t size = 256 * 1024;  // in bytes
+    unsigned ways = 8;           // at most 64
+    unsigned line_size = 64;     // in bytes
+    replacement policy = replacement::lru;
+    bool write_back = true;      // write-through otherwise
+    bool write_allocate = true;  // a write miss fetches the line
+    sc_time hit_latency{1, SC_NS};
+};
+
+/**
+ * set-associative cache in front of the memory bound to mem_socket. Tags, state and data live in
+ * flat arrays indexed by set * ways + way. Misses and write backs go downstream through
+ * b_transport, the latency of the last access (hit latency plus downstream delays) is available
+ * through access_latency().
+ */
+class sc_cache_device : public sc_mem_device {
 public:
     SC_HAS_PROCESS(sc_cache_device);
-    sc_cache_device(sc_module_name nm, uint64_t bs, uint64_t sz)
-    : sc_device(nm)
-    , base(bs)
-    , size(sz)
+
+    tlm_utils::simple_initiator_socket<sc_cache_device, 256> SC_NAMED(mem_socket);
+
+    struct cache_stats {
+        uint64_t read_hits{0};
+        uint64_t read_misses{0};
+        uint64_t write_hits{0};
+        uint64_t write_misses{0};
+        uint64_t evictions{0};
+        uint64_t writebacks{0};
+    };
+
+    sc_cache_device(sc_module_name nm, uint64_t bs, uint64_t sz, const cache_config& cfg = cache_config())
+    : sc_mem_device(nm, bs, sz)
+    , cfg(cfg)
     {
-    }
+        auto pow2 = [](uint64_t v) { return v != 0 && (v & (v - 1)) == 0; };
+        if (!pow2(cfg.size) || !pow2(cfg.ways) || !pow2(cfg.line_size) || cfg.ways > 64 ||
+            cfg.size < uint64_t(cfg.ways) * cfg.line_size) {
+            SC_REPORT_ERROR(name(), "invalid cache geometry");
+        }
+        sets = cfg.size / (uint64_t(cfg.ways) * cfg.line_size);
+        line_shift = __builtin_ctzll(cfg.line_size);
+        tags.resize(sets * cfg.ways);
+        flags.resize(sets * cfg.ways, 0);
+        stamps.resize(sets * cfg.ways, 0);
+        plru_bits.resize(sets, 0);
+        lines.resize(cfg.size);
 
-    uint64_t get_base() { return base; }
-    uint64_t get_size() { return size; }
+        auto& reg = util::stats_registry::instance();
+        const std::string prefix = std::string(name()) + ".";
+        reg.add(prefix + "read_hits", &stats.read_hits);
+        reg.add(prefix + "read_misses", &stats.read_misses);
+        reg.add(prefix + "write_hits", &stats.write_hits);
+        reg.add(prefix + "write_misses", &stats.write_misses);
+        reg.add(prefix + "evictions", &stats.evictions);
+        reg.add(prefix + "writebacks", &stats.writebacks);
+    }
 
     void read(uint64_t addr, uint8_t* data, size_t len) override {
         LOG_DBG("read from " << hex << addr);
-        uint64_t offset = addr - base;
-        uint64_t line_addr = offset / line_size;
-        uint64_t line_offset = offset % line_size;
-        if(cache.find(line_addr) == cache.end()) {
-            LOG_DBG("Cache miss");
-        } else {
-            LOG_DBG("Cache hit");
-            std::copy(cache[line_addr].data + line_offset, cache[line_addr].data + line_offset + len, data);
-        }
+        access(addr, data, len, false);
     }
 
     void write(uint64_t addr, const uint8_t* data, size_t len) override {
         LOG_DBG("write to " << hex << addr);
-        uint64_t offset = addr - base;
-        uint64_t line_addr = offset / line_size;
-        uint64_t line_offset = offset % line_size;
-        if(cache.find(line_addr) == cache.end()) {
-            cache[line_addr] = cache_line();
+        access(addr, const_cast<uint8_t*>(data), len, true);
+    }
+
+    sc_time access_latency() const override { return latency; }
+
+    // write all dirty lines back, lines stay valid
+    void flush() {
+        for (uint64_t i = 0; i < tags.size(); i++) {
+            if ((flags[i] & (VALID | DIRTY)) == (VALID | DIRTY)) {
+                transfer(tlm::TLM_WRITE_COMMAND, tags[i] << line_shift, line_ptr(i));
+                flags[i] &= ~DIRTY;
+                stats.writebacks++;
+            }
+        }
+    }
+
+    // untimed access that leaves the cache's state alone. Reads see the newest data, which may
+    // only be in a dirty line, writes update memory and the cached copy of the line
+    unsigned int transport_dbg(tlm::tlm_generic_payload& trans) {
+        const unsigned len = mem_socket->transport_dbg(trans);
+        uint64_t addr = trans.get_address();
+        uint8_t* data = trans.get_data_ptr();
+        for (unsigned done = 0; done < len;) {
+            const uint64_t offset = addr & (cfg.line_size - 1);
+            const size_t chunk = std::min<size_t>(len - done, cfg.line_size - offset);
+            const uint64_t line_addr = addr >> line_shift;
+            const uint64_t set = line_addr & (sets - 1);
+            const int way = find_way(set, line_addr);
+            if (way >= 0) {
+                uint8_t* line = line_ptr(set * cfg.ways + way) + offset;
+                if (trans.is_read()) {
+                    std::memcpy(data, line, chunk);
+                } else {
+                    std::memcpy(line, data, chunk);
+                }
+            }
+            addr += chunk;
+            data += chunk;
+            done += chunk;
         }
-        std::copy(data, data + len, cache[line_addr].data + line_offset);
-        cache[line_addr].valid = true;
+        return len;
     }
 
+    const cache_stats& get_stats() const { return stats; }
+    void reset_stats() { stats = cache_stats(); }
+
+    void print_stats(std::ostream& os) const {
+        const uint64_t accesses = stats.read_hits + stats.read_misses + stats.write_hits + stats.write_misses;
+        const uint64_t misses = stats.read_misses + stats.write_misses;
+        os << name() << ": " << dec << accesses << " accesses, " << misses << " misses ("
+           << (accesses ? 100.0 * misses / accesses : 0.0) << "%), read hits " << stats.read_hits
+           << ", read misses " << stats.read_misses << ", write hits " << stats.write_hits
+           << ", write misses " << stats.write_misses << ", evictions " << stats.evictions
+           << ", writebacks " << stats.writebacks << endl;
+    }
 
 private:
-    class cache_line {
-    public:
-        cache_line() : valid(false) {}
-        bool valid;
-        uint8_t data[64];
-    };
-    std::map<uint64_t, cache_line> cache;
-    uint64_t line_size = 64;
-    uint64_t associativity = 1;
+    static constexpr uint8_t VALID = 1;
+    static constexpr uint8_t DIRTY = 2;
 
-    uint64_t size; // in bytes
-    uint64_t base;
+    void access(uint64_t addr, uint8_t* data, size_t len, bool is_write) {
+        latency = cfg.hit_latency;
+        while (len > 0) {
+            const uint64_t offset = addr & (cfg.line_size - 1);
+            const size_t chunk = std::min<size_t>(len, cfg.line_size - offset);
+            access_line(addr, offset, data, chunk, is_write);
+            addr += chunk;
+            data += chunk;
+            len -= chunk;
+        }
+    }
+
+    void access_line(uint64_t addr, uint64_t offset, uint8_t* data, size_t len, bool is_write) {
+        const uint64_t line_addr = addr >> line_shift;
+        const uint64_t set = line_addr & (sets - 1);
+        int way = find_way(set, line_addr);
+
+        if (way < 0) {
+            (is_write ? stats.write_misses : stats.read_misses)++;
+            if (is_write && !cfg.write_allocate) {
+                transfer(tlm::TLM_WRITE_COMMAND, addr, data, len);
+                return;
+            }
+            way = fill(set, line_addr);
+        } else {
+            (is_write ? stats.write_hits : stats.read_hits)++;
+        }
+
+        const uint64_t idx = set * cfg.ways + way;
+        uint8_t* line = line_ptr(idx) + offset;
+        if (is_write) {
+            std::memcpy(line, data, len);
+            if (cfg.write_back) {
+                flags[idx] |= DIRTY;
+            } else {
+                transfer(tlm::TLM_WRITE_COMMAND, addr, data, len);
+            }
+        } else {
+            std::memcpy(data, line, len);
+        }
+        touch(set, way);
+    }
+
+    int find_way(uint64_t set, uint64_t line_addr) const {
+        const uint64_t first = set * cfg.ways;
+        for (unsigned w = 0; w < cfg.ways; w++) {
+            if ((flags[first + w] & VALID) && tags[first + w] == line_addr) {
+                return w;
+            }
+        }
+        return -1;
+    }
+
+    // evicts a victim if needed and reads the line from downstream
+    int fill(uint64_t set, uint64_t line_addr) {
+        const unsigned way = victim(set);
+        const uint64_t idx = set * cfg.ways + way;
+        if (flags[idx] & VALID) {
+            stats.evictions++;
+            if (flags[idx] & DIRTY) {
+                transfer(tlm::TLM_WRITE_COMMAND, tags[idx] << line_shift, line_ptr(idx));
+                stats.writebacks++;
+            }
+        }
+        transfer(tlm::TLM_READ_COMMAND, line_addr << line_shift, line_ptr(idx));
+        tags[idx] = line_addr;
+        flags[idx] = VALID;
+        return way;
+    }
+
+    unsigned victim(uint64_t set) {
+        const uint64_t first = set * cfg.ways;
+        for (unsigned w = 0; w < cfg.ways; w++) {
+            if (!(flags[first + w] & VALID)) {
+                return w;
+            }
+        }
+        switch (cfg.policy) {
+        case cache_config::replacement::lru: {
+            unsigned lru = 0;
+            for (unsigned w = 1; w < cfg.ways; w++) {
+                if (stamps[first + w] < stamps[first + lru]) {
+                    lru = w;
+                }
+            }
+            return lru;
+        }
+        case cache_config::replacement::plru: {
+            // tree nodes point towards the less recently used half
+            unsigned node = 0, way = 0;
+            for (unsigned level = 1; level < cfg.ways; level <<= 1) {
+                const unsigned bit = (plru_bits[set] >> node) & 1;
+                way = (way << 1) | bit;
+                node = 2 * node + 1 + bit;
+            }
+            return way;
+        }
+        case cache_config::replacement::random:
+        default:
+            rng ^= rng << 13;
+            rng ^= rng >> 7;
+            rng ^= rng << 17;
+            return rng & (cfg.ways - 1);
+        }
+    }
+
+    void touch(uint64_t set, unsigned way) {
+        stamps[set * cfg.ways + way] = ++clock;
+        if (cfg.policy == cache_config::replacement::plru) {
+            unsigned node = 0;
+            for (unsigned level = cfg.ways >> 1; level > 0; level >>= 1) {
+                const unsigned bit = (way & level) ? 1 : 0;
+                // point away from the way just used
+                plru_bits[set] = (plru_bits[set] & ~(uint64_t(1) << node)) | (uint64_t(!bit) << node);
+                node = 2 * node + 1 + bit;
+            }
+        }
+    }
+
+    // blocking transfer to the next level, its delay adds to the current access
+    void transfer(tlm::tlm_command cmd, uint64_t addr, uint8_t* data, size_t len = 0) {
+        tlm::tlm_generic_payload trans;
+        trans.set_command(cmd);
+        trans.set_address(addr);
+        trans.set_data_ptr(data);
+        trans.set_data_length(len ? len : cfg.line_size);
+        trans.set_streaming_width(len ? len : cfg.line_size);
+        sc_time delay = SC_ZERO_TIME;
+        mem_socket->b_transport(trans, delay);
+        latency += delay;
+    }
+
+    uint8_t* line_ptr(uint64_t idx) { return &lines[idx * cfg.line_size]; }
+
+    const cache_config cfg;
+    uint64_t sets;
+    unsigned line_shift;
+    std::vector<uint64_t> tags;     // line address, i.e. addr >> line_shift
+    std::vector<uint8_t> flags;     // VALID, DIRTY
+    std::vector<uint64_t> stamps;   // last use for LRU
+    std::vector<uint64_t> plru_bits; // one tree per set
+    std::vector<uint8_t> lines;
+    uint64_t clock{0};
+    uint64_t rng{0x9e3779b97f4a7c15ull};
+    sc_time latency{SC_ZERO_TIME};
+    cache_stats stats;
 };
 
 #endif
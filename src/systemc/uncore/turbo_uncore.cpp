@@ -5,36 +5,176 @@ turbo_uncore::turbo_uncore(sc_module_name nm, const cfg_t* cfg) :
     , debug_component("turbo_uncore") {
     // sockets
     init_socket.register_nb_transport_bw(this, &turbo_uncore::nb_transport_bw);
+    init_socket.register_invalidate_direct_mem_ptr(this, &turbo_uncore::invalidate_direct_mem_ptr);
     targ_socket.register_nb_transport_fw(this, &turbo_uncore::nb_transport_fw);
+    targ_socket.register_b_transport(this, &turbo_uncore::b_transport);
+    targ_socket.register_get_direct_mem_ptr(this, &turbo_uncore::get_direct_mem_ptr);
+    targ_socket.register_transport_dbg(this, &turbo_uncore::transport_dbg);
     // adding default devices
     cout << "Creating soc scr" << endl;
     sc_soc_scr* soc_scr = new sc_soc_scr("soc_scr", 0x3fffb000 /*base*/, 0x1000 /*size*/);
     bus.register_device(soc_scr);
     make_mems(cfg->mem_layout);
+
+    auto& reg = util::stats_registry::instance();
+    reg.add(std::string(name()) + ".memory_transactions", &memory_transactions);
+    reg.add(std::string(name()) + ".device_transactions", &device_transactions);
 };
 
 // TODO:
 tlm::tlm_sync_enum turbo_uncore::nb_transport_fw(tlm::tlm_generic_payload& trans, tlm::tlm_phase& phase, sc_time& t) {
+    HOST_PROF_SCOPE("turbo_uncore::nb_transport_fw");
     LOG_DBG("nb_transport_fw with phase: " << phase);
 
     tlm::tlm_sync_enum status = TLM_ACCEPTED;
+    if (trace && phase == BEGIN_REQ) {
+        record(trans, t);
+    }
     auto* device = bus.find_device(trans.get_address());
     // if device is nullptr, just forward the transaction to the memory
     if (device == nullptr) {
+        if (phase == BEGIN_REQ) {
+            memory_transactions++;
+        }
+        if (cache) {
+            // the cache answers right away, its latency is annotated to t
+            if (phase == BEGIN_REQ) {
+                access_cache(trans, t);
+            }
+            return TLM_COMPLETED;
+        }
         status = init_socket->nb_transport_fw(trans, phase, t);
     } else {
-        // This is for now modelled as immediate R/W
-        if (trans.is_read()) {
-            device->read(trans.get_address(), trans.get_data_ptr(), trans.get_data_length());
-        } else {
-            LOG_DBG("write to device at " << hex << trans.get_address());
-            device->write(trans.get_address(), trans.get_data_ptr(), trans.get_data_length());
-        }
+        access_device(device, trans);
         return TLM_COMPLETED;
     }
     return status;
 }
 
+void turbo_uncore::b_transport(tlm::tlm_generic_payload& trans, sc_time& t) {
+    if (trace) {
+        record(trans, t);
+    }
+    auto* device = bus.find_device(trans.get_address());
+    if (device == nullptr) {
+        memory_transactions++;
+        if (cache) {
+            access_cache(trans, t);
+        } else {
+            init_socket->b_transport(trans, t);
+        }
+    } else {
+        access_device(device, trans);
+        t += device->access_latency();
+    }
+}
+
+void turbo_uncore::record(tlm::tlm_generic_payload& trans, const sc_time& t) {
+    turbo_tlm_extension* ext = nullptr;
+    trans.get_extension(ext);
+    const sc_time when = sc_time_stamp() + t;
+    trace->record(when.value() / sc_time(1, SC_PS).value(), ext ? ext->coreId : 0, trans.get_address(),
+                  trans.get_data_length(), trans.is_write(), trans.get_data_ptr());
+}
+
+// This is for now modelled as immediate R/W
+void turbo_uncore::access_device(sc_device* device, tlm::tlm_generic_payload& trans) {
+    turbo_tlm_extension* ext = nullptr;
+    trans.get_extension(ext);
+    if (ext) {
+        ext->device_access = true;
+    }
+    device_transactions++;
+    if (trans.is_read()) {
+        device->traffic.reads++;
+        device->traffic.bytes_read += trans.get_data_length();
+        device->read(trans.get_address(), trans.get_data_ptr(), trans.get_data_length());
+    } else {
+        LOG_DBG("write to device at " << hex << trans.get_address());
+        device->traffic.writes++;
+        device->traffic.bytes_written += trans.get_data_length();
+        device->write(trans.get_address(), trans.get_data_ptr(), trans.get_data_length());
+    }
+    trans.set_response_status(tlm::TLM_OK_RESPONSE);
+}
+
+void turbo_uncore::enable_cache(const cache_config& cfg) {
+    cache = std::make_unique<sc_cache_device>("cache", 0, ~uint64_t(0), cfg);
+    cache_targ_socket = std::make_unique<cache_socket_t>("cache_targ_socket");
+    cache_targ_socket->register_b_transport(this, &turbo_uncore::cache_b_transport);
+    cache_targ_socket->register_transport_dbg(this, &turbo_uncore::cache_transport_dbg);
+    cache->mem_socket.bind(*cache_targ_socket);
+    if (isDebugEnabled()) {
+        cache->enableDebug(true);
+    }
+}
+
+// hits and misses alike complete at once, the whole latency is annotated to t
+void turbo_uncore::access_cache(tlm::tlm_generic_payload& trans, sc_time& t) {
+    if (trans.is_read()) {
+        cache->read(trans.get_address(), trans.get_data_ptr(), trans.get_data_length());
+    } else {
+        cache->write(trans.get_address(), trans.get_data_ptr(), trans.get_data_length());
+    }
+    t += cache->access_latency();
+    trans.set_response_status(tlm::TLM_OK_RESPONSE);
+}
+
+void turbo_uncore::cache_b_transport(tlm::tlm_generic_payload& trans, sc_time& t) {
+    init_socket->b_transport(trans, t);
+}
+
+unsigned int turbo_uncore::cache_transport_dbg(tlm::tlm_generic_payload& trans) {
+    return init_socket->transport_dbg(trans);
+}
+
+// devices are accessed through transactions only, memory behind init_socket may grant DMI
+bool turbo_uncore::get_direct_mem_ptr(tlm::tlm_generic_payload& trans, tlm::tlm_dmi& dmi_data) {
+    const sc_bus_device::range r = bus.decode(trans.get_address());
+    if (r.dev) {
+        dmi_data.allow_none();
+        dmi_data.set_start_address(r.base);
+        dmi_data.set_end_address(r.last);
+        return false;
+    }
+    if (cache) {
+        // direct accesses would bypass the cache
+        dmi_data.allow_none();
+        dmi_data.set_start_address(r.base);
+        dmi_data.set_end_address(r.last);
+        return false;
+    }
+
+    bool granted = init_socket->get_direct_mem_ptr(trans, dmi_data);
+
+    // the range returned by memory must not cover any device, r is the gap between them
+    if (dmi_data.get_start_address() < r.base) {
+        if (dmi_data.get_dmi_ptr()) {
+            dmi_data.set_dmi_ptr(dmi_data.get_dmi_ptr() + (r.base - dmi_data.get_start_address()));
+        }
+        dmi_data.set_start_address(r.base);
+    }
+    if (dmi_data.get_end_address() > r.last) {
+        dmi_data.set_end_address(r.last);
+    }
+    return granted;
+}
+
+// device registers have side effects and do not answer debug accesses
+unsigned int turbo_uncore::transport_dbg(tlm::tlm_generic_payload& trans) {
+    if (bus.find_device(trans.get_address()) != nullptr) {
+        return 0;
+    }
+    if (cache) {
+        return cache->transport_dbg(trans);
+    }
+    return init_socket->transport_dbg(trans);
+}
+
+void turbo_uncore::invalidate_direct_mem_ptr(sc_dt::uint64 start, sc_dt::uint64 end) {
+    targ_socket->invalidate_direct_mem_ptr(start, end);
+}
+
 tlm::tlm_sync_enum turbo_uncore::nb_transport_bw(tlm::tlm_generic_payload& trans, tlm::tlm_phase& phase, sc_time& t) {
     LOG_DBG("nb_transport_bw with phase: " << phase);
 
@@ -68,5 +208,8 @@ void turbo_uncore::set_debug() {
     for(auto& dev : bus.get_devices()) {
         dev.second->enableDebug(true);
     }
+    if (cache) {
+        cache->enableDebug(true);
+    }
 
 }
@@ -7,6 +7,9 @@ using namespace tlm;
 #include <tlm_utils/simple_target_socket.h>
 
 #include "util/dbg_component.h"
+#include "util/mem_trace.h"
+#include "util/host_prof.h"
+#include "turbo/turbo_tlm_extension.h"
 #include "sc_devices.h"
 #include "riscv/cfg.h"
 
@@ -27,9 +30,41 @@ public:
 
     tlm::tlm_sync_enum nb_transport_bw(tlm::tlm_generic_payload& trans, tlm::tlm_phase& phase, sc_time& t);
     tlm::tlm_sync_enum nb_transport_fw(tlm::tlm_generic_payload& trans, tlm::tlm_phase& phase, sc_time& t);
+    void b_transport(tlm::tlm_generic_payload& trans, sc_time& t);
+    bool get_direct_mem_ptr(tlm::tlm_generic_payload& trans, tlm::tlm_dmi& dmi_data);
+    unsigned int transport_dbg(tlm::tlm_generic_payload& trans);
+    void invalidate_direct_mem_ptr(sc_dt::uint64 start, sc_dt::uint64 end);
 
     void set_debug();
 
+    // record every request crossing the uncore into a binary trace, see util/mem_trace.h
+    void start_trace(const std::string& file, bool with_data) {
+        trace = std::make_unique<util::mem_trace_writer>(file, with_data);
+    }
+
+    // put an sc_cache_device in front of the memory behind init_socket, call before sc_start.
+    // Memory is then only accessed through the cache and DMI is denied for it
+    void enable_cache(const cache_config& cfg);
+    sc_cache_device* get_cache() { return cache.get(); }
+    // write the cache's dirty lines back to memory, e.g. before the memory is saved
+    void flush_cache() {
+        if (cache) {
+            cache->flush();
+        }
+    }
+
 private:
+    void access_device(sc_device* device, tlm::tlm_generic_payload& trans);
+    std::unique_ptr<sc_cache_device> cache;
+    // the cache's misses and write backs, forwarded to init_socket. Only exists with a cache
+    using cache_socket_t = tlm_utils::simple_target_socket<turbo_uncore, 256, tlm::tlm_base_protocol_types>;
+    std::unique_ptr<cache_socket_t> cache_targ_socket;
+    void access_cache(tlm::tlm_generic_payload& trans, sc_time& t);
+    void cache_b_transport(tlm::tlm_generic_payload& trans, sc_time& t);
+    unsigned int cache_transport_dbg(tlm::tlm_generic_payload& trans);
+    std::unique_ptr<util::mem_trace_writer> trace;
+    void record(tlm::tlm_generic_payload& trans, const sc_time& t);
+    uint64_t memory_transactions{0};
+    uint64_t device_transactions{0};
     sc_bus_device SC_NAMED(bus);
 };
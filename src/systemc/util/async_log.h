@@ -0,0 +1,339 @@
+// Copyright 2025 SiFive
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef _ASYNC_LOG_H_
+#define _ASYNC_LOG_H_
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace util {
+
+/**
+ * @brief single producer, single consumer ring buffer
+ *
+ * The simulation thread pushes, the log writer thread pops. Neither side takes a lock.
+ */
+template <typename T, size_t N>
+class spsc_ring {
+    static_assert((N & (N - 1)) == 0, "ring size must be a power of two");
+
+public:
+    bool push(T&& value) {
+        const size_t h = head.load(std::memory_order_relaxed);
+        if (h - tail.load(std::memory_order_acquire) == N) {
+            return false;
+        }
+        slots[h & (N - 1)] = std::move(value);
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+    T* front() {
+        const size_t t = tail.load(std::memory_order_relaxed);
+        if (t == head.load(std::memory_order_acquire)) {
+            return nullptr;
+        }
+        return &slots[t & (N - 1)];
+    }
+
+    void pop() { tail.store(tail.load(std::memory_order_relaxed) + 1, std::memory_order_release); }
+
+private:
+    T slots[N];
+    alignas(64) std::atomic<size_t> head{0};
+    alignas(64) std::atomic<size_t> tail{0};
+};
+
+/**
+ * @brief one log entry, copied into the ring as it is. Memory traces and the operands of text
+ * messages are kept binary and only formatted by the writer thread.
+ */
+struct log_record {
+    enum kind_t : uint8_t { text, mem_request, mem_read_done, mem_write_done };
+
+    uint64_t seq;          // global order across components
+    double time;           // simulation time of the event
+    kind_t kind;
+    bool print_name;
+    bool is_read;          // mem_request only
+    bool truncated;        // text only, the operands did not fit into data
+    uint32_t phase;        // mem_request only
+    uint64_t addr;
+    uint32_t len;          // bytes of the access (at most sizeof(data) are recorded) or of the operands
+    uint8_t data[192];     // the access's data or the operands encoded by log_args
+};
+
+/**
+ * @brief encodes the operands of a text message into a log_record, used like an ostream
+ *
+ * Integers, floating point numbers, text and hex/dec are copied into the record and formatted by
+ * the writer thread. Other types are formatted with their operator<< right away. Operands that do
+ * not fit are dropped and the message ends in "...".
+ */
+class log_args {
+public:
+    enum tag : uint8_t { t_text, t_signed, t_unsigned, t_double, t_bool, t_hex, t_dec };
+
+    explicit log_args(log_record& rec) : rec(rec) {
+        rec.kind = log_record::text;
+        rec.len = 0;
+        rec.truncated = false;
+    }
+
+    log_args& operator<<(const char* s) { return text(s, std::strlen(s)); }
+    log_args& operator<<(const std::string& s) { return text(s.data(), s.size()); }
+    log_args& operator<<(char c) { return text(&c, 1); }
+    log_args& operator<<(bool b) { return value(t_bool, uint8_t(b)); }
+    log_args& operator<<(double d) { return value(t_double, d); }
+
+    template <typename T, typename std::enable_if<std::is_integral<T>::value, int>::type = 0>
+    log_args& operator<<(T v) {
+        return std::is_signed<T>::value ? value(t_signed, int64_t(v)) : value(t_unsigned, uint64_t(v));
+    }
+
+    log_args& operator<<(std::ios_base& (*manip)(std::ios_base&)) {
+        if (manip == static_cast<std::ios_base& (*)(std::ios_base&)>(std::hex)) {
+            put(t_hex, nullptr, 0);
+        } else if (manip == static_cast<std::ios_base& (*)(std::ios_base&)>(std::dec)) {
+            put(t_dec, nullptr, 0);
+        }
+        return *this;
+    }
+
+    template <typename T, typename std::enable_if<!std::is_arithmetic<T>::value, int>::type = 0>
+    log_args& operator<<(const T& v) {
+        std::ostringstream os;
+        os << v;
+        return *this << os.str();
+    }
+
+    // the writer's side, formats the operands encoded in rec
+    static void format(const log_record& rec, std::ostream& os) {
+        for (uint32_t pos = 0; pos < rec.len;) {
+            const tag t = tag(rec.data[pos++]);
+            switch (t) {
+            case t_text: {
+                uint16_t n;
+                std::memcpy(&n, rec.data + pos, sizeof(n));
+                os.write(reinterpret_cast<const char*>(rec.data + pos + sizeof(n)), n);
+                pos += sizeof(n) + n;
+                break;
+            }
+            case t_signed:
+            case t_unsigned:
+            case t_double: {
+                uint64_t bits;
+                std::memcpy(&bits, rec.data + pos, sizeof(bits));
+                if (t == t_signed) {
+                    os << int64_t(bits);
+                } else if (t == t_unsigned) {
+                    os << bits;
+                } else {
+                    double d;
+                    std::memcpy(&d, &bits, sizeof(d));
+                    os << d;
+                }
+                pos += sizeof(bits);
+                break;
+            }
+            case t_bool:
+                os << bool(rec.data[pos++]);
+                break;
+            case t_hex:
+                os << std::hex;
+                break;
+            case t_dec:
+                os << std::dec;
+                break;
+            }
+        }
+        if (rec.truncated) {
+            os << "...";
+        }
+    }
+
+private:
+    template <typename T> log_args& value(tag t, T v) {
+        put(t, &v, sizeof(v));
+        return *this;
+    }
+
+    // a string that does not fit keeps what fits behind its tag and length
+    log_args& text(const char* s, size_t n) {
+        const size_t room = rec.len + 3 < sizeof(rec.data) ? sizeof(rec.data) - rec.len - 3 : 0;
+        const uint16_t len = uint16_t(std::min(n, room));
+        if (put(t_text, &len, sizeof(len))) {
+            std::memcpy(rec.data + rec.len, s, len);
+            rec.len += len;
+        }
+        rec.truncated |= len < n;
+        return *this;
+    }
+
+    // tag and payload go in together or not at all
+    bool put(tag t, const void* payload, size_t n) {
+        if (rec.truncated || rec.len + 1 + n > sizeof(rec.data)) {
+            rec.truncated = true;
+            return false;
+        }
+        rec.data[rec.len++] = t;
+        std::memcpy(rec.data + rec.len, payload, n);
+        rec.len += n;
+        return true;
+    }
+
+    log_record& rec;
+};
+
+/**
+ * @brief background thread that drains the per-component rings in global sequence order and
+ * writes the formatted records to stdout
+ */
+class log_writer {
+public:
+    static constexpr size_t ring_size = 4096;
+    using ring = spsc_ring<log_record, ring_size>;
+
+    static log_writer& instance() {
+        static log_writer writer;
+        return writer;
+    }
+
+    // a ring for one component, tagged with its name on output
+    ring* add_ring(const std::string& name) {
+        std::lock_guard<std::mutex> guard(rings_lock);
+        rings.push_back({name, std::make_unique<ring>()});
+        if (!worker.joinable()) {
+            worker = std::thread([this]() { run(); });
+        }
+        return rings.back().second.get();
+    }
+
+    uint64_t next_seq() { return seq.fetch_add(1, std::memory_order_relaxed); }
+
+    // blocks the producer while the ring is full, nothing is dropped
+    void push(ring* r, log_record&& rec) {
+        while (!r->push(std::move(rec))) {
+            std::this_thread::yield();
+        }
+    }
+
+    // returns once everything pushed so far has been written
+    void flush() {
+        const uint64_t target = seq.load(std::memory_order_relaxed);
+        while (written.load(std::memory_order_acquire) < target && worker.joinable()) {
+            std::this_thread::yield();
+        }
+        fflush(stdout);
+    }
+
+    ~log_writer() {
+        stop.store(true, std::memory_order_release);
+        if (worker.joinable()) {
+            worker.join();
+        }
+    }
+
+private:
+    log_writer() = default;
+
+    void run() {
+        while (true) {
+            const bool stopping = stop.load(std::memory_order_acquire);
+            if (drain() == 0) {
+                if (stopping) {
+                    break;
+                }
+                fflush(stdout);
+                std::this_thread::sleep_for(std::chrono::microseconds(200));
+            }
+        }
+        fflush(stdout);
+    }
+
+    // writes all queued records, oldest first, returns the number written
+    size_t drain() {
+        std::lock_guard<std::mutex> guard(rings_lock);
+        size_t n = 0;
+        while (true) {
+            size_t best = rings.size();
+            for (size_t i = 0; i < rings.size(); i++) {
+                log_record* rec = rings[i].second->front();
+                if (rec && (best == rings.size() || rec->seq < rings[best].second->front()->seq)) {
+                    best = i;
+                }
+            }
+            if (best == rings.size()) {
+                return n;
+            }
+            write(rings[best].first, *rings[best].second->front());
+            rings[best].second->pop();
+            written.fetch_add(1, std::memory_order_release);
+            n++;
+        }
+    }
+
+    void write(const std::string& name, const log_record& rec) {
+        if (rec.kind == log_record::text) {
+            std::ostringstream text;
+            log_args::format(rec, text);
+            if (rec.print_name) {
+                printf("[%s] %s\n", name.c_str(), text.str().c_str());
+            } else {
+                printf("%s\n", text.str().c_str());
+            }
+            return;
+        }
+        printf("[%s] {\"t\":%g,\"addr\":\"0x%llx\"", name.c_str(), rec.time, (unsigned long long)rec.addr);
+        if (rec.kind == log_record::mem_request) {
+            printf(", \"msg\":\"%s phase %s\"}\n", rec.is_read ? "TLM_MEM_READ" : "TLM_MEM_WRITE",
+                   phase_name(rec.phase));
+            return;
+        }
+        printf(",\"data\":\"0x");
+        for (uint32_t i = 0; i < std::min<uint32_t>(rec.len, sizeof(rec.data)); i++) {
+            printf("%02x", rec.data[i]);
+        }
+        printf("\",\"msg\":\"%s done\"}\n", rec.kind == log_record::mem_read_done ? "TLM_MEM_READ" : "TLM_MEM_WRITE");
+    }
+
+    // names of tlm::tlm_phase_enum, kept here so this header does not need SystemC
+    static const char* phase_name(uint32_t phase) {
+        static const char* names[] = {"UNINITIALIZED_PHASE", "BEGIN_REQ", "END_REQ", "BEGIN_RESP", "END_RESP"};
+        return phase < 5 ? names[phase] : "UNKNOWN_PHASE";
+    }
+
+    std::mutex rings_lock; // taken by add_ring and the writer, never on the push path
+    std::vector<std::pair<std::string, std::unique_ptr<ring>>> rings;
+    std::atomic<uint64_t> seq{0};
+    std::atomic<uint64_t> written{0};
+    std::atomic<bool> stop{false};
+    std::thread worker;
+};
+
+} // namespace util
+
+#endif /* _ASYNC_LOG_H_ */
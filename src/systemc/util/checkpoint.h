@@ -0,0 +1,322 @@
+// Copyright 2025 SiFive
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef _CHECKPOINT_H_
+#define _CHECKPOINT_H_
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+namespace util {
+
+/**
+ * @brief simulator checkpoint made of tagged sections
+ *
+ * A checkpoint file starts with a checkpoint_header followed by sections, each one a
+ * checkpoint_section header and its payload padded to 8 bytes. Memory sections hold the page
+ * numbers of all non-zero pages of a sparse_array followed by the page contents. The contents
+ * start at a file offset aligned to the page size, so a restore maps them straight from the file
+ * and only pages the guest touches are ever read. Delta sections have the same layout and hold the
+ * pages written since the previous snapshot, zero pages included. Values are stored in host byte
+ * order.
+ */
+struct checkpoint_header {
+    char magic[8];      // "SIMCKPT"
+    uint32_t version;
+    uint32_t reserved;
+
+    static constexpr uint32_t current_version = 1;
+};
+
+struct checkpoint_section {
+    char tag[8];        // zero padded
+    uint64_t size;      // payload bytes, without padding
+};
+
+// payload of a memory section, followed by count page numbers
+struct checkpoint_mem_index {
+    uint64_t page_size;
+    uint64_t count;
+    uint64_t data_offset; // file offset of the first page
+};
+
+/**
+ * @brief writes a checkpoint to a temporary file that replaces file on close()
+ *
+ * The file being replaced may still back memory restored from it, so it is never truncated or
+ * written in place. Without close() the temporary file is removed and file is left as it was.
+ */
+class checkpoint_writer {
+public:
+    explicit checkpoint_writer(const std::string& file)
+    : file(file)
+    , tmp_file(file + ".tmp" + std::to_string(getpid())) {
+        fp = fopen(tmp_file.c_str(), "wb");
+        if (!fp) {
+            throw std::runtime_error("cannot open checkpoint file " + tmp_file);
+        }
+        checkpoint_header header{{'S', 'I', 'M', 'C', 'K', 'P', 'T', 0},
+                                 checkpoint_header::current_version, 0};
+        put(&header, sizeof(header));
+    }
+
+    ~checkpoint_writer() {
+        if (fp) {
+            fclose(fp);
+            unlink(tmp_file.c_str());
+        }
+    }
+
+    checkpoint_writer(const checkpoint_writer&) = delete;
+    checkpoint_writer& operator=(const checkpoint_writer&) = delete;
+
+    void add(const std::string& tag, const void* data, size_t len) {
+        begin(tag, len);
+        put(data, len);
+        pad(8);
+    }
+
+    void add(const std::string& tag, const std::vector<uint8_t>& data) { add(tag, data.data(), data.size()); }
+
+    /**
+     * add the allocated pages of a sparse_array, pages holding only zeros are left out
+     */
+    template <typename SA> void add_memory(const std::string& tag, const SA& mem) {
+        std::vector<std::pair<uint64_t, const void*>> pages;
+        mem.for_each_page([&](uint64_t page_nr, const typename SA::page_type& page) {
+            if (!is_zero(page.data(), sizeof(page))) {
+                pages.emplace_back(page_nr, page.data());
+            }
+        });
+        add_pages(tag, sizeof(typename SA::page_type), pages);
+    }
+
+    /**
+     * add the pages written since the last clear_dirty of a sparse_array, including pages that
+     * were zeroed. Applied on top of the memory it was taken from, it yields the current contents
+     */
+    template <typename SA> void add_memory_delta(const std::string& tag, const SA& mem) {
+        std::vector<std::pair<uint64_t, const void*>> pages;
+        mem.for_each_dirty_page([&](uint64_t page_nr, const typename SA::page_type& page) {
+            pages.emplace_back(page_nr, page.data());
+        });
+        add_pages(tag, sizeof(typename SA::page_type), pages);
+    }
+
+    // flushes the file and moves it in place, throws if anything could not be written
+    void close() {
+        const bool ok = fflush(fp) == 0 && !ferror(fp);
+        fclose(fp);
+        fp = nullptr;
+        if (!ok || rename(tmp_file.c_str(), file.c_str()) != 0) {
+            unlink(tmp_file.c_str());
+            throw std::runtime_error("error writing checkpoint file " + file);
+        }
+    }
+
+private:
+    static bool is_zero(const void* p, size_t len) {
+        const uint64_t* w = static_cast<const uint64_t*>(p);
+        for (size_t i = 0; i < len / sizeof(uint64_t); i++) {
+            if (w[i]) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void add_pages(const std::string& tag, uint64_t page_size, const std::vector<std::pair<uint64_t, const void*>>& pages) {
+        const uint64_t align = std::max<uint64_t>(page_size, sysconf(_SC_PAGESIZE));
+        const uint64_t index_end = pos + sizeof(checkpoint_section) + sizeof(checkpoint_mem_index)
+                                   + pages.size() * sizeof(uint64_t);
+        checkpoint_mem_index index{page_size, pages.size(), (index_end + align - 1) / align * align};
+        begin(tag, index.data_offset - pos - sizeof(checkpoint_section) + pages.size() * page_size);
+        put(&index, sizeof(index));
+        for (auto& p : pages) {
+            put(&p.first, sizeof(p.first));
+        }
+        pad(align);
+        for (auto& p : pages) {
+            put(p.second, page_size);
+        }
+    }
+
+    void begin(const std::string& tag, uint64_t size) {
+        checkpoint_section section{};
+        std::memcpy(section.tag, tag.data(), std::min(tag.size(), sizeof(section.tag)));
+        section.size = size;
+        put(&section, sizeof(section));
+    }
+
+    void put(const void* data, size_t len) {
+        fwrite(data, 1, len, fp);
+        pos += len;
+    }
+
+    void pad(uint64_t align) {
+        static const char zeros[4096]{};
+        while (pos % align) {
+            put(zeros, std::min<uint64_t>(align - pos % align, sizeof(zeros)));
+        }
+    }
+
+    std::string file;
+    std::string tmp_file;
+    FILE* fp{nullptr};
+    uint64_t pos{0};
+};
+
+class checkpoint_reader {
+public:
+    explicit checkpoint_reader(const std::string& file) : file(file) {
+        fd = open(file.c_str(), O_RDONLY);
+        struct stat st;
+        if (fd < 0 || fstat(fd, &st) != 0) {
+            fail("cannot open checkpoint file ");
+        }
+        len = st.st_size;
+        if (len < sizeof(checkpoint_header)) {
+            fail("not a checkpoint: ");
+        }
+        base = static_cast<uint8_t*>(mmap(nullptr, len, PROT_READ, MAP_PRIVATE, fd, 0));
+        if (base == MAP_FAILED) {
+            fail("cannot map checkpoint file ");
+        }
+        const auto* header = reinterpret_cast<const checkpoint_header*>(base);
+        if (std::memcmp(header->magic, "SIMCKPT", 8) != 0
+            || header->version != checkpoint_header::current_version) {
+            fail("not a checkpoint: ");
+        }
+        uint64_t pos = sizeof(checkpoint_header);
+        while (pos + sizeof(checkpoint_section) <= len) {
+            const auto* section = reinterpret_cast<const checkpoint_section*>(base + pos);
+            pos += sizeof(checkpoint_section);
+            if (section->size > len - pos) {
+                fail("truncated checkpoint: ");
+            }
+            sections[std::string(section->tag, strnlen(section->tag, sizeof(section->tag)))] = {pos, section->size};
+            pos += (section->size + 7) / 8 * 8;
+        }
+    }
+
+    ~checkpoint_reader() { release(); }
+
+    checkpoint_reader(const checkpoint_reader&) = delete;
+    checkpoint_reader& operator=(const checkpoint_reader&) = delete;
+
+    bool has(const std::string& tag) const { return sections.count(tag) != 0; }
+
+    // payload of a section, valid as long as the reader lives
+    std::pair<const uint8_t*, size_t> get(const std::string& tag) const {
+        auto it = sections.find(tag);
+        if (it == sections.end()) {
+            throw std::runtime_error("checkpoint " + file + " has no section " + tag);
+        }
+        return {base + it->second.first, it->second.second};
+    }
+
+    /**
+     * replace the contents of a sparse_array by a memory section. The pages are mapped
+     * copy-on-write from the file and the mapping is handed to the array, so nothing is read
+     * before the guest touches it. The file must stay as it is while the array uses the mapping:
+     * truncating it raises SIGBUS on the next access, changing it in place may change pages the
+     * guest has not written yet. Replacing or deleting it is fine, which is how checkpoint_writer
+     * overwrites files.
+     */
+    template <typename SA> void restore_memory(const std::string& tag, SA& mem) const {
+        using page_type = typename SA::page_type;
+        const checkpoint_mem_index index = memory_index(tag, sizeof(page_type));
+        mem.clear();
+        if (index.count == 0) {
+            return;
+        }
+        const size_t map_len = index.count * sizeof(page_type);
+        void* pages = mmap(nullptr, map_len, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, index.data_offset);
+        if (pages == MAP_FAILED) {
+            throw std::runtime_error("cannot map checkpoint file " + file);
+        }
+        mem.adopt_mapping(pages, map_len);
+        const uint64_t* nrs = page_nrs(tag);
+        for (uint64_t i = 0; i < index.count; i++) {
+            mem.attach_page(nrs[i], static_cast<page_type*>(pages) + i);
+        }
+    }
+
+    /**
+     * copy the pages of a memory section written by add_memory_delta into a sparse_array holding
+     * the contents the delta was taken from
+     */
+    template <typename SA> void apply_memory_delta(const std::string& tag, SA& mem) const {
+        using page_type = typename SA::page_type;
+        const checkpoint_mem_index index = memory_index(tag, sizeof(page_type));
+        const uint64_t* nrs = page_nrs(tag);
+        for (uint64_t i = 0; i < index.count; i++) {
+            mem.write_range(nrs[i] * sizeof(page_type),
+                            base + index.data_offset + i * sizeof(page_type), sizeof(page_type));
+        }
+    }
+
+private:
+    void release() {
+        if (base != MAP_FAILED) {
+            munmap(base, len);
+        }
+        if (fd >= 0) {
+            ::close(fd);
+        }
+    }
+
+    checkpoint_mem_index memory_index(const std::string& tag, uint64_t page_size) const {
+        auto payload = get(tag);
+        checkpoint_mem_index index;
+        std::memcpy(&index, payload.first, sizeof(index));
+        if (index.page_size != page_size
+            || sizeof(index) + index.count * sizeof(uint64_t) > payload.second
+            || index.data_offset + index.count * page_size > len) {
+            throw std::runtime_error("checkpoint " + file + " does not match the memory layout");
+        }
+        return index;
+    }
+
+    const uint64_t* page_nrs(const std::string& tag) const {
+        return reinterpret_cast<const uint64_t*>(get(tag).first + sizeof(checkpoint_mem_index));
+    }
+
+    // the destructor does not run for a throwing constructor
+    [[noreturn]] void fail(const char* msg) {
+        release();
+        throw std::runtime_error(msg + file);
+    }
+
+    std::string file;
+    int fd{-1};
+    uint8_t* base{static_cast<uint8_t*>(MAP_FAILED)};
+    uint64_t len{0};
+    std::map<std::string, std::pair<uint64_t, uint64_t>> sections; // tag -> offset, size
+};
+
+} // namespace util
+
+#endif /* _CHECKPOINT_H_ */
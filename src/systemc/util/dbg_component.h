@@ -18,7 +18,24 @@
 #include <iostream>
 #include <string>
 #include <sstream>
+#include "async_log.h"
 
+// Log levels, everything above DBG_COMPILE_LEVEL is compiled out, e.g. -DDBG_COMPILE_LEVEL=0
+// removes all debug logging including the runtime checks
+#define DBG_LEVEL_NONE  0
+#define DBG_LEVEL_DEBUG 1 // LOG_DBG messages
+#define DBG_LEVEL_TRACE 2 // per transaction memory traces
+
+#ifndef DBG_COMPILE_LEVEL
+#define DBG_COMPILE_LEVEL DBG_LEVEL_TRACE
+#endif
+
+/**
+ * Records are queued in a per-component lock-free ring and written by a background thread, so
+ * logging does not block the simulation on stdout. LOG_DBG copies its operands into the record
+ * (util::log_args) and memory traces are queued as binary records, both are formatted by the
+ * writer. Call util::log_writer::instance().flush() before printing to stdout directly.
+ */
 class debug_component {
     public:
     debug_component(const std::string& nm) 
@@ -27,15 +44,48 @@ class debug_component {
     ~debug_component() = default;
 
     void log_debug(const std::string& message, bool print_name = true) {
-        if(isDebugEn && print_name) {
-            std::cout << "[" << dbg_name << "] " << message << std::endl;
-        } else if(isDebugEn) {
-            std::cout << message << std::endl;
+        if(isDebugEn) {
+            util::log_record rec;
+            util::log_args(rec) << message;
+            log_text(rec, print_name);
         }
     }
+
+    // queues a record filled through util::log_args
+    void log_text(util::log_record& rec, bool print_name = true) {
+        rec.seq = util::log_writer::instance().next_seq();
+        rec.print_name = print_name;
+        util::log_writer::instance().push(ring, std::move(rec));
+    }
+
+    // memory trace of a request (phase) or a completed access (data)
+    void log_mem_request(double time, uint64_t addr, bool is_read, uint32_t phase) {
+        util::log_record rec;
+        rec.seq = util::log_writer::instance().next_seq();
+        rec.time = time;
+        rec.kind = util::log_record::mem_request;
+        rec.addr = addr;
+        rec.is_read = is_read;
+        rec.phase = phase;
+        util::log_writer::instance().push(ring, std::move(rec));
+    }
+
+    void log_mem_done(double time, uint64_t addr, bool is_read, const uint8_t* data, uint32_t len) {
+        util::log_record rec;
+        rec.seq = util::log_writer::instance().next_seq();
+        rec.time = time;
+        rec.kind = is_read ? util::log_record::mem_read_done : util::log_record::mem_write_done;
+        rec.addr = addr;
+        rec.len = len;
+        std::memcpy(rec.data, data, std::min<size_t>(len, sizeof(rec.data)));
+        util::log_writer::instance().push(ring, std::move(rec));
+    }
     
     // Add methods to enable/disable debugging
     void enableDebug(bool enable = true) {
+        if (enable && ring == nullptr) {
+            ring = util::log_writer::instance().add_ring(dbg_name);
+        }
         isDebugEn = enable;
     }
     
@@ -52,19 +102,44 @@ class debug_component {
 
     template<typename T>
     void log_dbg(T&& msg) {
-        std::ostringstream os;
-        os << std::forward<T>(msg);
-        log_dbg(std::move(os));
+        if (isDebugEnabled()) {
+            util::log_record rec;
+            util::log_args(rec) << std::forward<T>(msg);
+            log_text(rec);
+        }
     }
 
+#if DBG_COMPILE_LEVEL >= DBG_LEVEL_DEBUG
 #define LOG_DBG(...) \
     do { \
-        if (isDebugEnabled()) { \
-            std::ostringstream os; \
-            os << __VA_ARGS__; \
-            log_debug(os.str()); \
+        if (__builtin_expect(isDebugEnabled(), 0)) { \
+            util::log_record log_rec_; \
+            util::log_args log_args_(log_rec_); \
+            log_args_ << __VA_ARGS__; \
+            log_text(log_rec_); \
+        } \
+    } while(0)
+#else
+#define LOG_DBG(...) do {} while(0)
+#endif
+
+#if DBG_COMPILE_LEVEL >= DBG_LEVEL_TRACE
+#define TRACE_MEM_REQUEST(...) \
+    do { \
+        if (__builtin_expect(isDebugEnabled(), 0)) { \
+            log_mem_request(__VA_ARGS__); \
         } \
     } while(0)
+#define TRACE_MEM_DONE(...) \
+    do { \
+        if (__builtin_expect(isDebugEnabled(), 0)) { \
+            log_mem_done(__VA_ARGS__); \
+        } \
+    } while(0)
+#else
+#define TRACE_MEM_REQUEST(...) do {} while(0)
+#define TRACE_MEM_DONE(...) do {} while(0)
+#endif
     
     inline bool isDebugEnabled() const {
         return isDebugEn;
@@ -73,6 +148,7 @@ class debug_component {
     private:
     const std::string dbg_name;
     bool isDebugEn{false}; // Changed from const to allow runtime modification
+    util::log_writer::ring* ring{nullptr};
 };
 
 
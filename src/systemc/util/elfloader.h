@@ -39,10 +39,67 @@
 #include <map>
 
 #include <util/sparse_array.h>
+#include <util/symbol_index.h>
 
+// Loads one PT_LOAD segment: the file part is copied, the rest (BSS) zeroed without allocating
+// pages. With map_file, buf must be a private writable mapping of the file and pages fully covered
+// by the file part are not copied but taken straight from buf, copy-on-write. That needs the
+// segment's address and file offset to agree modulo the page size and the page to be unallocated,
+// other pages are copied. A file page is attached at most once, mapped_pages records them.
+// Returns whether a page of buf was attached.
+template <typename T, int upper_width, int lower_width>
+bool load_segment(util::sparse_array<T, upper_width, lower_width>* memif, char* buf, uint64_t paddr,
+                  uint64_t offset, uint64_t filesz, uint64_t memsz, bool map_file,
+                  std::vector<bool>& mapped_pages) {
+    using page_type = typename util::sparse_array<T, upper_width, lower_width>::page_type;
+    const uint64_t page_size = sizeof(page_type);
+    const uint64_t first = (paddr + page_size - 1) & ~(page_size - 1); // first page fully in the file part
+    const uint64_t end = (paddr + filesz) & ~(page_size - 1);          // end of the last one
+    bool attached = false;
+    if (map_file && (paddr - offset) % page_size == 0 && first < end) {
+        memif->write_range(paddr, (uint8_t*)buf + offset, first - paddr);
+        for (uint64_t addr = first; addr < end; addr += page_size) {
+            const uint64_t file_offset = offset + (addr - paddr);
+            char* src = buf + file_offset;
+            if (memif->is_allocated(addr) || mapped_pages[file_offset / page_size]) {
+                memif->write_range(addr, (uint8_t*)src, page_size);
+            } else {
+                memif->attach_page(addr / page_size, reinterpret_cast<page_type*>(src));
+                mapped_pages[file_offset / page_size] = true;
+                attached = true;
+            }
+        }
+        memif->write_range(end, (uint8_t*)buf + offset + (end - paddr), paddr + filesz - end);
+    } else if (filesz) {
+        memif->write_range(paddr, (uint8_t*)buf + offset, filesz);
+    }
+    if (memsz > filesz) {
+        memif->zero_range(paddr + filesz, memsz - filesz);
+    }
+    return attached;
+}
+
+// Adds an ELF symbol to index. Section and file symbols, undefined, absolute and common symbols and
+// the $x/$d mapping symbols do not name code or data of their own and are left out. section_end
+// bounds symbols without a size.
+inline void index_elf_symbol(util::symbol_index* index, const char* name, uint64_t value, uint64_t size,
+                             uint8_t info, unsigned shndx, uint64_t section_end) {
+    const unsigned type = info & 0xf, bind = info >> 4; // STT_*, STB_*
+    if(type == 3 || type == 4 || type == 6 || shndx == 0 || shndx >= 0xff00 || !*name || *name == '$')
+        return;
+    auto kind = type == 2 ? util::symbol_index::kind::function
+              : type == 1 ? util::symbol_index::kind::object : util::symbol_index::kind::other;
+    index->add(name, value, size, kind, bind != 0, section_end);
+}
+
+// With map_file, segments are mapped from the file instead of copied (see load_segment) and the file
+// mapping is handed to memif, so loading costs about the pages the guest actually touches.
+// With index, the symbols including their sizes and types are added to it and it is rebuilt.
+// Without memif only the symbols are read, e.g. for a program restored from a checkpoint.
 template <typename T, int upper_width, int lower_width>
 std::map<std::string, uint64_t> load_elf(const char* fn, util::sparse_array<T, upper_width, lower_width>* memif,
-                                         uint64_t* entry) {
+                                         uint64_t* entry, bool map_file = false,
+                                         util::symbol_index* index = nullptr) {
     int fd = open(fn, O_RDONLY);
     struct stat s;
     assert(fd != -1);
@@ -50,7 +107,7 @@ std::map<std::string, uint64_t> load_elf(const char* fn, util::sparse_array<T, u
         abort();
     size_t size = s.st_size;
 
-    char* buf = (char*)mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    char* buf = (char*)mmap(NULL, size, map_file ? PROT_READ | PROT_WRITE : PROT_READ, MAP_PRIVATE, fd, 0);
     assert(buf != MAP_FAILED);
     close(fd);
 
@@ -62,8 +119,9 @@ std::map<std::string, uint64_t> load_elf(const char* fn, util::sparse_array<T, u
     assert(IS_ELF_RISCV(*eh64) || IS_ELF_EM_NONE(*eh64));
     assert(IS_ELF_VCURRENT(*eh64));
 
-    std::vector<uint8_t> zeros;
     std::map<std::string, uint64_t> symbols;
+    bool attached = false;
+    std::vector<bool> mapped_pages(map_file ? size / (uint64_t(1) << lower_width) + 1 : 0);
 
 #define LOAD_ELF(ehdr_t, phdr_t, shdr_t, sym_t, bswap)                                                                 \
     do {                                                                                                               \
@@ -72,15 +130,10 @@ std::map<std::string, uint64_t> load_elf(const char* fn, util::sparse_array<T, u
         *entry = bswap(eh->e_entry);                                                                                   \
         assert(size >= bswap(eh->e_phoff) + bswap(eh->e_phnum) * sizeof(*ph));                                         \
         for(unsigned i = 0; i < bswap(eh->e_phnum); i++) {                                                             \
-            if(bswap(ph[i].p_type) == PT_LOAD && bswap(ph[i].p_memsz)) {                                               \
-                if(bswap(ph[i].p_filesz)) {                                                                            \
-                    assert(size >= bswap(ph[i].p_offset) + bswap(ph[i].p_filesz));                                     \
-                    memif->write(bswap(ph[i].p_paddr), (uint8_t*)buf + bswap(ph[i].p_offset), bswap(ph[i].p_filesz));  \
-                }                                                                                                      \
-                if(size_t pad = bswap(ph[i].p_memsz) - bswap(ph[i].p_filesz)) {                                        \
-                    /*zeros.resize(pad);*/                                                                             \
-                    /*memif->write(bswap(ph[i].p_paddr) + bswap(ph[i].p_filesz), zeros.data(), pad);*/                 \
-                }                                                                                                      \
+            if(memif && bswap(ph[i].p_type) == PT_LOAD && bswap(ph[i].p_memsz)) {                                      \
+                assert(size >= bswap(ph[i].p_offset) + bswap(ph[i].p_filesz));                                         \
+                attached |= load_segment(memif, buf, bswap(ph[i].p_paddr), bswap(ph[i].p_offset),                      \
+                                         bswap(ph[i].p_filesz), bswap(ph[i].p_memsz), map_file, mapped_pages);         \
             }                                                                                                          \
         }                                                                                                              \
         shdr_t* sh = (shdr_t*)(buf + bswap(eh->e_shoff));                                                              \
@@ -109,6 +162,14 @@ std::map<std::string, uint64_t> load_elf(const char* fn, util::sparse_array<T, u
                 assert(bswap(sym[i].st_name) < bswap(sh[strtabidx].sh_size));                                          \
                 assert(strnlen(strtab + bswap(sym[i].st_name), max_len) < max_len);                                    \
                 symbols[strtab + bswap(sym[i].st_name)] = bswap(sym[i].st_value);                                      \
+                if(index) {                                                                                            \
+                    unsigned shndx = bswap(sym[i].st_shndx);                                                           \
+                    uint64_t section_end = shndx < bswap(eh->e_shnum)                                                  \
+                                               ? uint64_t(bswap(sh[shndx].sh_addr)) + bswap(sh[shndx].sh_size)         \
+                                               : 0;                                                                    \
+                    index_elf_symbol(index, strtab + bswap(sym[i].st_name), bswap(sym[i].st_value),                    \
+                                     bswap(sym[i].st_size), sym[i].st_info, shndx, section_end);                       \
+                }                                                                                                      \
             }                                                                                                          \
         }                                                                                                              \
     } while(0)
@@ -125,7 +186,8 @@ std::map<std::string, uint64_t> load_elf(const char* fn, util::sparse_array<T, u
         throw std::invalid_argument(
             "Specified ELF is big endian.  Configure with --enable-dual-endian to enable support");
 #else
-        memif->set_target_endianness(memif_endianness_big);
+        if(memif)
+            memif->set_target_endianness(memif_endianness_big);
         if(IS_ELF32(*eh64))
             LOAD_ELF(Elf32_Ehdr, Elf32_Phdr, Elf32_Shdr, Elf32_Sym, from_be);
         else
@@ -133,7 +195,14 @@ std::map<std::string, uint64_t> load_elf(const char* fn, util::sparse_array<T, u
 #endif
     }
 
-    munmap(buf, size);
+    if(index)
+        index->build();
+
+    if(attached) {
+        memif->adopt_mapping(buf, size);
+    } else {
+        munmap(buf, size);
+    }
 
     return symbols;
 }
@@ -0,0 +1,183 @@
+// Copyright 2025 SiFive
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef _HART_STATE_H_
+#define _HART_STATE_H_
+
+#include "riscv/processor.h"
+#include "riscv/mmu.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+namespace util {
+
+namespace hart_state_detail {
+
+// read-only CSRs follow from the configuration and are neither saved nor restored
+inline bool is_read_only(reg_t addr) { return ((addr >> 10) & 3) == 3; }
+
+// restore order: writes to FP and vector CSRs mark mstatus dirty and locked PMP entries ignore
+// address writes, so the configuration and status registers go last
+inline int restore_rank(reg_t addr) {
+    if (addr >= CSR_PMPCFG0 && addr < CSR_PMPADDR0) {
+        return 1;
+    }
+    if (addr == CSR_SSTATUS || addr == CSR_VSSTATUS || addr == CSR_MSTATUS || addr == CSR_MSTATUSH) {
+        return 2;
+    }
+    return 0;
+}
+
+class blob_reader {
+public:
+    blob_reader(const uint8_t* data, size_t len) : data(data), len(len) {}
+
+    template <typename T> T get() {
+        T v;
+        get(&v, sizeof(v));
+        return v;
+    }
+
+    void get(void* dst, size_t n) {
+        if (n > len - pos) {
+            throw std::runtime_error("truncated hart state");
+        }
+        std::memcpy(dst, data + pos, n);
+        pos += n;
+    }
+
+private:
+    const uint8_t* data;
+    size_t len;
+    size_t pos{0};
+};
+
+} // namespace hart_state_detail
+
+/**
+ * @brief architectural state of a Spike hart as a flat byte blob
+ *
+ * Covers pc, privilege mode, integer, floating-point and vector registers and all writable CSRs.
+ * Only the currently selected debug trigger is captured through tselect/tdata.
+ */
+inline std::vector<uint8_t> save_hart_state(processor_t* p) {
+    std::vector<uint8_t> blob;
+    auto put = [&](const auto& v) {
+        const uint8_t* b = reinterpret_cast<const uint8_t*>(&v);
+        blob.insert(blob.end(), b, b + sizeof(v));
+    };
+    state_t* s = p->get_state();
+    put(uint64_t(p->get_max_xlen()));
+    put(uint64_t(p->VU.vlenb));
+    put(uint64_t(s->pc));
+    put(uint64_t(s->prv));
+    put(uint8_t(s->v));
+    put(uint8_t(s->debug_mode));
+    for (int i = 0; i < NXPR; i++) {
+        put(uint64_t(s->XPR[i]));
+    }
+    for (int i = 0; i < NFPR; i++) {
+        put(s->FPR[i]);
+    }
+    if (p->VU.vlenb && p->VU.reg_file) {
+        put(uint64_t(p->VU.vl->read()));
+        put(uint64_t(p->VU.vtype->read()));
+        put(uint64_t(p->VU.vstart->read()));
+        const uint8_t* v = static_cast<const uint8_t*>(p->VU.reg_file);
+        blob.insert(blob.end(), v, v + NVPR * p->VU.vlenb);
+    }
+    std::vector<std::pair<reg_t, reg_t>> csrs;
+    for (auto& csr : s->csrmap) {
+        if (!hart_state_detail::is_read_only(csr.first)) {
+            csrs.emplace_back(csr.first, csr.second->read());
+        }
+    }
+    std::sort(csrs.begin(), csrs.end());
+    put(uint64_t(csrs.size()));
+    for (auto& csr : csrs) {
+        put(uint64_t(csr.first));
+        put(uint64_t(csr.second));
+    }
+    return blob;
+}
+
+/**
+ * restore a hart saved by save_hart_state, throws if the hart is configured differently
+ */
+inline void restore_hart_state(processor_t* p, const uint8_t* data, size_t len) {
+    hart_state_detail::blob_reader in(data, len);
+    state_t* s = p->get_state();
+    if (in.get<uint64_t>() != p->get_max_xlen() || in.get<uint64_t>() != p->VU.vlenb) {
+        throw std::runtime_error("hart state does not match the hart configuration");
+    }
+    const reg_t pc = in.get<uint64_t>();
+    const reg_t prv = in.get<uint64_t>();
+    const bool virt = in.get<uint8_t>();
+    const bool debug_mode = in.get<uint8_t>();
+    for (int i = 0; i < NXPR; i++) {
+        s->XPR.write(i, in.get<uint64_t>());
+    }
+    for (int i = 0; i < NFPR; i++) {
+        s->FPR.write(i, in.get<freg_t>());
+    }
+    reg_t vl = 0, vtype = 0, vstart = 0;
+    if (p->VU.vlenb && p->VU.reg_file) {
+        vl = in.get<uint64_t>();
+        vtype = in.get<uint64_t>();
+        vstart = in.get<uint64_t>();
+        in.get(p->VU.reg_file, NVPR * p->VU.vlenb);
+    }
+    std::vector<std::pair<reg_t, reg_t>> csrs(in.get<uint64_t>());
+    for (auto& csr : csrs) {
+        csr.first = in.get<uint64_t>();
+        csr.second = in.get<uint64_t>();
+        if (s->csrmap.count(csr.first) == 0) {
+            throw std::runtime_error("hart state does not match the hart configuration");
+        }
+    }
+    std::stable_sort(csrs.begin(), csrs.end(), [](const auto& a, const auto& b) {
+        return hart_state_detail::restore_rank(a.first) < hart_state_detail::restore_rank(b.first);
+    });
+    for (auto& csr : csrs) {
+        if (csr.first == CSR_VSTART) {
+            continue; // set_vl below clears it
+        }
+        auto& reg = s->csrmap[csr.first];
+        reg->write(csr.second);
+        // Spike compensates counter writes for the increment of the writing instruction
+        if ((csr.first == CSR_MINSTRET || csr.first == CSR_MCYCLE) && reg->read() != csr.second) {
+            reg->write(2 * csr.second - reg->read());
+        }
+    }
+    if (p->VU.vlenb && p->VU.reg_file) {
+        p->VU.set_vl(1, 1, vl, vtype);
+        p->VU.vstart->write_raw(vstart);
+    }
+    s->pc = pc;
+    p->set_privilege(prv, virt);
+    s->debug_mode = debug_mode;
+    // translations and the reservation belong to the state before the restore
+    p->get_mmu()->flush_tlb();
+    p->get_mmu()->flush_icache();
+    p->get_mmu()->yield_load_reservation();
+}
+
+} // namespace util
+
+#endif /* _HART_STATE_H_ */
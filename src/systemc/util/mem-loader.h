@@ -6,21 +6,23 @@
 
 class MemoryLoader{
     private:
-      util::sparse_array<uint8_t, 18, 30>* mem_ptr; // pointer to memory array
+      util::sparse_array<uint8_t, 36, 12>* mem_ptr; // pointer to memory array
   
     public:
     MemoryLoader() = delete;
-    MemoryLoader(util::sparse_array<uint8_t, 18, 30>* m_ptr)
+    MemoryLoader(util::sparse_array<uint8_t, 36, 12>* m_ptr)
     : mem_ptr(m_ptr)
     {
   
     }
 
-    uint64_t loadElf(std::string elfFName) {
+    // map_file: take whole pages straight from a copy-on-write mapping of the file instead of copying them
+    // symbols: also add the ELF symbols with their sizes and types to this index
+    uint64_t loadElf(std::string elfFName, bool map_file = false, util::symbol_index* symbols = nullptr) {
       uint64_t start_address;
       if (FILE *file = fopen(elfFName.c_str(), "r")) {
         fclose(file);
-        auto x = load_elf(elfFName.c_str(), mem_ptr, &start_address); // TODO: fix this
+        auto x = load_elf(elfFName.c_str(), mem_ptr, &start_address, map_file, symbols); // TODO: fix this
         std::cout << "start address of elf " << elfFName << " is : 0x" << hex << start_address << std::endl;
       } else {
         std::cerr << "File name " << elfFName << " cannot be read " << std::endl;
@@ -0,0 +1,193 @@
+// Copyright 2025 SiFive
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef _MEM_TRACE_H_
+#define _MEM_TRACE_H_
+
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace util {
+
+/**
+ * @brief binary memory transaction trace
+ *
+ * A trace file starts with a mem_trace_header followed by mem_trace_records. Every record of a
+ * write is followed by its size bytes of data if the trace was recorded with data. Values are
+ * stored in host byte order.
+ */
+struct mem_trace_header {
+    char magic[8];      // "MEMTRACE"
+    uint32_t version;
+    uint32_t flags;     // with_data
+
+    static constexpr uint32_t current_version = 1;
+    static constexpr uint32_t with_data = 1;
+};
+
+struct mem_trace_record {
+    uint64_t time_ps;   // simulation time the request was issued
+    uint64_t addr;
+    uint32_t size;
+    uint16_t hart;
+    uint8_t is_write;
+    uint8_t reserved;
+};
+static_assert(sizeof(mem_trace_record) == 24, "trace records must stay packed");
+
+/**
+ * @brief records a trace with double-buffered file output
+ *
+ * Records are appended to the active buffer, full buffers are written by a background thread
+ * while the simulation fills the other one.
+ */
+class mem_trace_writer {
+public:
+    static constexpr size_t buffer_size = 1 << 20;
+
+    mem_trace_writer(const std::string& file, bool with_data) : data(with_data) {
+        fp = fopen(file.c_str(), "wb");
+        if (!fp) {
+            throw std::runtime_error("cannot open trace file " + file);
+        }
+        mem_trace_header header{{'M', 'E', 'M', 'T', 'R', 'A', 'C', 'E'},
+                                mem_trace_header::current_version,
+                                with_data ? mem_trace_header::with_data : 0};
+        fwrite(&header, sizeof(header), 1, fp);
+        active.reserve(buffer_size);
+        pending.reserve(buffer_size);
+        worker = std::thread([this]() { run(); });
+    }
+
+    ~mem_trace_writer() {
+        {
+            std::unique_lock<std::mutex> lock(mtx);
+            cv.wait(lock, [this]() { return pending.empty(); });
+            pending.swap(active);
+            stop = true;
+        }
+        cv.notify_all();
+        worker.join();
+        fclose(fp);
+    }
+
+    void record(uint64_t time_ps, uint16_t hart, uint64_t addr, uint32_t size, bool is_write,
+                const uint8_t* bytes) {
+        mem_trace_record rec{time_ps, addr, size, hart, uint8_t(is_write), 0};
+        append(&rec, sizeof(rec));
+        if (data && is_write) {
+            append(bytes, size);
+        }
+        records++;
+    }
+
+    uint64_t recorded() const { return records; }
+
+private:
+    void append(const void* p, size_t len) {
+        if (active.size() + len > buffer_size) {
+            submit();
+        }
+        const uint8_t* b = static_cast<const uint8_t*>(p);
+        active.insert(active.end(), b, b + len);
+    }
+
+    // hands the active buffer to the writer, waits only if the previous one is still being written
+    void submit() {
+        {
+            std::unique_lock<std::mutex> lock(mtx);
+            cv.wait(lock, [this]() { return pending.empty(); });
+            pending.swap(active);
+        }
+        cv.notify_all();
+    }
+
+    void run() {
+        std::vector<uint8_t> buf;
+        buf.reserve(buffer_size);
+        while (true) {
+            bool done;
+            {
+                std::unique_lock<std::mutex> lock(mtx);
+                cv.wait(lock, [this]() { return !pending.empty() || stop; });
+                buf.swap(pending);
+                done = stop;
+            }
+            cv.notify_all();
+            fwrite(buf.data(), 1, buf.size(), fp);
+            buf.clear();
+            if (done) {
+                return;
+            }
+        }
+    }
+
+    FILE* fp;
+    const bool data;
+    uint64_t records{0};
+    std::vector<uint8_t> active;
+    std::vector<uint8_t> pending; // empty while the writer is idle
+    std::mutex mtx;
+    std::condition_variable cv;
+    bool stop{false};
+    std::thread worker;
+};
+
+// sequential reader for traces written by mem_trace_writer
+class mem_trace_reader {
+public:
+    explicit mem_trace_reader(const std::string& file) {
+        fp = fopen(file.c_str(), "rb");
+        mem_trace_header header;
+        if (!fp || fread(&header, sizeof(header), 1, fp) != 1 || std::memcmp(header.magic, "MEMTRACE", 8) != 0 ||
+            header.version != mem_trace_header::current_version) {
+            throw std::runtime_error("not a memory trace: " + file);
+        }
+        data = header.flags & mem_trace_header::with_data;
+        setvbuf(fp, nullptr, _IOFBF, 1 << 20);
+    }
+
+    ~mem_trace_reader() { fclose(fp); }
+
+    bool has_data() const { return data; }
+
+    // the data of a write is returned in bytes if the trace has data
+    bool next(mem_trace_record& rec, std::vector<uint8_t>& bytes) {
+        if (fread(&rec, sizeof(rec), 1, fp) != 1) {
+            return false;
+        }
+        if (data && rec.is_write) {
+            bytes.resize(rec.size);
+            if (fread(bytes.data(), 1, rec.size, fp) != rec.size) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+private:
+    FILE* fp;
+    bool data;
+};
+
+} // namespace util
+
+#endif /* _MEM_TRACE_H_ */
@@ -0,0 +1,103 @@
+// Copyright 2025 SiFive
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef _MMIO_REGIONS_H_
+#define _MMIO_REGIONS_H_
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace util {
+
+/**
+ * @brief table of device registers living inside a memory model's address space
+ *
+ * Every page overlapping a registered region is flagged as MMIO. Memory models only consult the
+ * table for accesses to flagged pages, so ordinary RAM accesses pay a single range compare.
+ * Handlers return true when they consumed the access, false to let it fall through to the backing
+ * memory as well.
+ */
+class mmio_region_table {
+public:
+    using write_handler = std::function<bool(uint64_t offset, const uint8_t* data, size_t len)>;
+    using read_handler = std::function<bool(uint64_t offset, uint8_t* data, size_t len)>;
+
+    static constexpr uint64_t page_size = 0x1000;
+
+    struct region {
+        std::string name;
+        uint64_t base;
+        uint64_t size;
+        write_handler on_write;
+        read_handler on_read;
+    };
+
+    void add_region(const std::string& name, uint64_t base, uint64_t size,
+                    write_handler on_write = nullptr, read_handler on_read = nullptr) {
+        regions.push_back({name, base, size, std::move(on_write), std::move(on_read)});
+        for (uint64_t page = base / page_size; page <= (base + size - 1) / page_size; page++) {
+            auto it = std::lower_bound(pages.begin(), pages.end(), page);
+            if (it == pages.end() || *it != page) {
+                pages.insert(it, page);
+            }
+        }
+        lo = pages.front() * page_size;
+        span = (pages.back() + 1) * page_size - lo;
+    }
+
+    inline bool is_mmio_page(uint64_t addr) const {
+        if (addr - lo >= span) {
+            return false;
+        }
+        return std::binary_search(pages.begin(), pages.end(), addr / page_size);
+    }
+
+    bool write(uint64_t addr, const uint8_t* data, size_t len) const {
+        if (const region* r = find(addr)) {
+            return r->on_write && r->on_write(addr - r->base, data, len);
+        }
+        return false;
+    }
+
+    bool read(uint64_t addr, uint8_t* data, size_t len) const {
+        if (const region* r = find(addr)) {
+            return r->on_read && r->on_read(addr - r->base, data, len);
+        }
+        return false;
+    }
+
+    const std::vector<region>& get_regions() const { return regions; }
+
+private:
+    const region* find(uint64_t addr) const {
+        for (const auto& r : regions) {
+            if (addr - r.base < r.size) {
+                return &r;
+            }
+        }
+        return nullptr;
+    }
+
+    std::vector<region> regions;
+    std::vector<uint64_t> pages; // sorted page numbers overlapping any region
+    uint64_t lo{0};
+    uint64_t span{0};
+};
+
+} // namespace util
+
+#endif /* _MMIO_REGIONS_H_ */
@@ -0,0 +1,131 @@
+// Copyright 2025 SiFive
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef _STATS_H_
+#define _STATS_H_
+
+#include <systemc>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <map>
+#include <string>
+
+namespace util {
+
+/**
+ * @brief platform wide registry of named statistics
+ *
+ * Components register a getter per value under a dotted name, usually prefixed with their
+ * hierarchical SystemC name ("tb.mem.mem_module_0.bytes_read"). Values are read only when the
+ * registry is dumped, so publishing a statistic costs nothing on the simulation path beyond
+ * maintaining the counter itself. Registered components must outlive the last dump.
+ */
+class stats_registry {
+public:
+    using getter = std::function<double()>;
+
+    static stats_registry& instance() {
+        static stats_registry registry;
+        return registry;
+    }
+
+    void add(const std::string& name, getter get) { stats[name] = std::move(get); }
+
+    void add(const std::string& name, const uint64_t* counter) {
+        stats[name] = [counter]() { return double(*counter); };
+    }
+
+    // one JSON object with all statistics sorted by name, integral values are printed as integers
+    void dump_json(std::ostream& os) const {
+        os << "{";
+        const char* sep = "";
+        for (const auto& s : stats) {
+            const double v = s.second();
+            os << sep << "\"" << s.first << "\":";
+            if (!std::isfinite(v)) {
+                os << "null";
+            } else if (v == std::floor(v) && std::fabs(v) < 9007199254740992.0) {
+                os << (long long)v;
+            } else {
+                os << std::setprecision(12) << v;
+            }
+            sep = ",";
+        }
+        os << "}";
+    }
+
+private:
+    std::map<std::string, getter> stats;
+};
+
+/**
+ * @brief writes the registry as JSON lines to a file, every interval of simulated time (if not
+ * zero) and once more at the end of simulation. The last line is the final state.
+ */
+class stats_reporter : public sc_core::sc_module {
+public:
+    SC_HAS_PROCESS(stats_reporter);
+
+    stats_reporter(sc_core::sc_module_name nm, const std::string& file,
+                   const sc_core::sc_time& interval = sc_core::SC_ZERO_TIME)
+    : sc_core::sc_module(nm)
+    , out(file)
+    , interval(interval)
+    , start(std::chrono::steady_clock::now()) {
+        auto& reg = stats_registry::instance();
+        reg.add("sim.time_ns", []() { return sc_core::sc_time_stamp().to_seconds() * 1e9; });
+        reg.add("sim.wall_time_s", [this]() {
+            return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        });
+        if (interval != sc_core::SC_ZERO_TIME) {
+            SC_THREAD(run);
+        }
+    }
+
+    void dump() {
+        stats_registry::instance().dump_json(out);
+        out << std::endl;
+    }
+
+    // the final dump, sc_main calls it as well in case sc_start returned without sc_stop
+    void dump_final() {
+        if (!final_dumped) {
+            dump();
+            final_dumped = true;
+        }
+    }
+
+    void end_of_simulation() override { dump_final(); }
+
+private:
+    void run() {
+        while (true) {
+            wait(interval);
+            dump();
+        }
+    }
+
+    std::ofstream out;
+    bool final_dumped{false};
+    sc_core::sc_time interval;
+    std::chrono::steady_clock::time_point start;
+};
+
+} // namespace util
+
+#endif /* _STATS_H_ */
@@ -0,0 +1,77 @@
+// Copyright 2025 SiFive
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef _TLM_MM_H_
+#define _TLM_MM_H_
+
+#include <tlm.h>
+#include <cstdint>
+#include <vector>
+
+namespace util {
+
+/**
+ * @brief free-list memory manager for generic payloads
+ *
+ * Payloads are reference counted. Every component holding on to a transaction past the call it
+ * received it in does acquire()/release(). When the last reference is released the payload is
+ * reset and goes back to the free list. Extensions set with set_extension() survive the reset, so an
+ * initiator can attach its extension once and reuse it with the payload.
+ */
+class tlm_mm : public tlm::tlm_mm_interface {
+public:
+    tlm_mm() = default;
+    tlm_mm(const tlm_mm&) = delete;
+    tlm_mm& operator=(const tlm_mm&) = delete;
+
+    ~tlm_mm() {
+        for (auto* trans : pool) {
+            delete trans;
+        }
+    }
+
+    // returns a payload with a reference count of 0, the caller acquires it
+    tlm::tlm_generic_payload* allocate() {
+        if (free_list.empty()) {
+            auto* trans = new tlm::tlm_generic_payload(this);
+            pool.push_back(trans);
+            return trans;
+        }
+        auto* trans = free_list.back();
+        free_list.pop_back();
+        return trans;
+    }
+
+    void free(tlm::tlm_generic_payload* trans) override {
+        trans->reset(); // drops auto extensions only
+        trans->set_data_ptr(nullptr);
+        trans->set_byte_enable_ptr(nullptr);
+        trans->set_byte_enable_length(0);
+        trans->set_streaming_width(0);
+        trans->set_response_status(tlm::TLM_INCOMPLETE_RESPONSE);
+        free_list.push_back(trans);
+    }
+
+    // payloads created so far, stays constant once the pool is warm
+    uint64_t allocations() const { return pool.size(); }
+    uint64_t in_use() const { return pool.size() - free_list.size(); }
+
+private:
+    std::vector<tlm::tlm_generic_payload*> pool;
+    std::vector<tlm::tlm_generic_payload*> free_list;
+};
+
+} // namespace util
+
+#endif /* _TLM_MM_H_ */